@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,19 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// A reader that knows which blocks it will want next can
+// bprefetch() them: the reads go to the disk together, and
+// complete in the background.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET chains,
+// each with its own lock, so lookups of different blocks
+// rarely contend. Each bucket also keeps its unused buffers
+// on a free list, in the order they were released, so its
+// oldest is at the front. A cache miss takes bcache.lock to
+// serialize eviction, then recycles the oldest of the
+// buckets' oldest, looking at one buffer per bucket rather
+// than at all NBUF.
 
 
 #include "types.h"
@@ -22,70 +35,202 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
-struct {
+#define NBUCKET 61
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;    // chain through buf.next
+  struct buf *free;    // unused bufs, oldest first, through buf.fnext
+  struct buf *ftail;   // ... and the newest
+  uint64 nlookup;      // bget() calls that hashed here
+  uint64 ncontend;     // ... that found the lock already held
+};
+
+// Event counters for iostat(), bumped with atomic adds.
+struct iostat iostat;
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes eviction
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Put b, which just became unused, at the end of bk's free
+// list. Caller holds bk->lock.
+static void
+free_append(struct bucket *bk, struct buf *b)
+{
+  b->fnext = 0;
+  b->fprev = bk->ftail;
+  if(bk->ftail)
+    bk->ftail->fnext = b;
+  else
+    bk->free = b;
+  bk->ftail = b;
+}
+
+// Take b off bk's free list. Caller holds bk->lock.
+static void
+free_remove(struct bucket *bk, struct buf *b)
+{
+  if(b->fprev)
+    b->fprev->fnext = b->fnext;
+  else
+    bk->free = b->fnext;
+  if(b->fnext)
+    b->fnext->fprev = b->fprev;
+  else
+    bk->ftail = b->fprev;
+  b->fnext = b->fprev = 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  initticketlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; they migrate
+  // to the right bucket as they are recycled.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+    bk = &bcache.bucket[(b - bcache.buf) % NBUCKET];
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bk->head;
+    bk->head = b;
+    free_append(bk, b);
   }
 }
 
+// Lock bucket bk, counting whether another CPU had it.
+static void
+bucket_acquire(struct bucket *bk)
+{
+  int busy = bk->lock.locked;
+
+  acquire(&bk->lock);
+  bk->nlookup++;
+  if(busy)
+    bk->ncontend++;
+}
+
+// Look for a cached copy of (dev, blockno) in bk.
+// Caller holds bk->lock.
+static struct buf*
+bucket_find(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return locked buffer; but if full isn't 0,
+// don't wait: return 0 for a cached block rather than wait for
+// its lock, and return 0 and set *full if no buffer is free,
+// rather than panic.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int *full)
 {
-  struct buf *b;
+  struct buf *b, *victim, **pp;
+  struct bucket *bk, *vbk, *obk;
+  int i;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  bucket_acquire(bk);
+  if((b = bucket_find(bk, dev, blockno)) != 0){
+    if(full){
+      release(&bk->lock);
+      return 0;
     }
+    if(b->refcnt++ == 0)
+      free_remove(bk, b);
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
+
+  // Not cached. Only one CPU evicts at a time, so holding
+  // more than one bucket lock below cannot deadlock: every
+  // other path holds at most one.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Someone may have cached it while bk was unlocked.
+  if((b = bucket_find(bk, dev, blockno)) != 0){
+    if(full){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
+    }
+    if(b->refcnt++ == 0)
+      free_remove(bk, b);
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Recycle the unused buffer with the oldest timestamp,
+  // keeping the lock of the bucket that holds it. Each
+  // bucket's oldest is at the front of its free list.
+  victim = 0;
+  vbk = 0;
+  for(i = 0; i < NBUCKET; i++){
+    obk = &bcache.bucket[i];
+    if(obk != bk)
+      acquire(&obk->lock);
+    b = obk->free;
+    if(b && (victim == 0 || b->timestamp < victim->timestamp)){
+      if(vbk && vbk != bk)
+        release(&vbk->lock);
+      victim = b;
+      vbk = obk;
+    } else if(obk != bk){
+      release(&obk->lock);
     }
   }
-  panic("bget: no buffers");
+  if(victim == 0){
+    if(full == 0)
+      panic("bget: no buffers");
+    release(&bk->lock);
+    release(&bcache.lock);
+    *full = 1;
+    return 0;
+  }
+
+  // Move the victim into bk's chain.
+  free_remove(vbk, victim);
+  if(vbk != bk){
+    for(pp = &vbk->head; *pp != victim; pp = &(*pp)->next)
+      ;
+    *pp = victim->next;
+    release(&vbk->lock);
+    victim->next = bk->head;
+    bk->head = victim;
+  }
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->ahead = 0;
+  victim->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,11 +239,32 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
+  if(!b->valid) {
+    virtio_disk_rw(b, 0);
+    b->valid = 1;
+  }
+  b->ahead = 0;
+  return b;
+}
+
+// bread() a block of file data for readi(), counting whether
+// read-ahead had fetched it: the blocks it prefetches are all
+// file data, so only these reads tell whether it works.
+struct buf*
+breaddata(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    IOSTAT(ramiss, 1);
+  } else if(b->ahead) {
+    IOSTAT(rahit, 1);
   }
+  b->ahead = 0;
   return b;
 }
 
@@ -111,43 +277,112 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Give up a locked buffer.
+// Stamp it with the time of last use for bget()'s eviction.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->timestamp = ticks;
+    free_append(bk, b);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b);
+}
 
-  releasesleep(&b->lock);
+// The disk has read a block for bprefetch(). Called by
+// virtio_disk_intr(), on behalf of the process that started
+// the read, so holdingsleep() wouldn't pass.
+static void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  b->done = 0;
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Start reading the n blocks blockno[0..n-1] of dev into the
+// cache, and return without waiting for them. Blocks already
+// cached are skipped, and if every buffer is in use the rest
+// aren't read. A bread() of a block on its way in waits for
+// bdone() to unlock the buffer. n is at most NPREFETCH.
+void
+bprefetch(uint dev, uint *blockno, int n)
+{
+  struct buf *b, *bufs[NPREFETCH];
+  int i, m = 0, full = 0;
+
+  if(n > NPREFETCH)
+    panic("bprefetch");
+  for(i = 0; i < n && !full; i++){
+    if((b = bget(dev, blockno[i], &full)) == 0)
+      continue;
+    b->done = bdone;
+    b->ahead = 1;
+    bufs[m++] = b;
+  }
+  if(m > 0){
+    virtio_disk_submit(bufs, m, 0);
+    IOSTAT(prefetch, m);
   }
-  
-  release(&bcache.lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(b->refcnt++ == 0)
+    free_remove(bk, b);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(--b->refcnt == 0){
+    b->timestamp = ticks;
+    free_append(bk, b);
+  }
+  release(&bk->lock);
 }
 
+// Print per-bucket lookup and contention counters.
+// Runs when user types ^P on console. No lock, like procdump().
+void
+bcachedump(void)
+{
+  struct bucket *bk;
 
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    printf("bucket%d: lookup %d contend %d\n", (int)(bk - bcache.bucket),
+           (int)bk->nlookup, (int)bk->ncontend);
+}
+
+// Copy the disk and file system event counters out to
+// user address addr.
+int
+iostat_read(pagetable_t pagetable, uint64 addr)
+{
+  struct iostat st = iostat;
+
+  return copyout(pagetable, addr, (char *)&st, sizeof(st));
+}
@@ -1,12 +1,15 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read by bprefetch(), and not bread() since?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint timestamp;   // ticks at last brelse(), for eviction
+  struct buf *next; // hash bucket chain
+  struct buf *fnext, *fprev; // bucket's free list, while refcnt is 0
+  void (*done)(struct buf*); // if set, virtio_disk_intr() calls it when done
   uchar data[BSIZE];
 };
 
@@ -58,14 +58,23 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  int i, r;
 
   acquire(&cons.lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; ){
     char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
-      break;
+    if(either_copyin(&c, user_src, src+i, 1) == -1){
+      // the page may be out on swap or not read from its
+      // file yet, which takes sleeping without cons.lock.
+      release(&cons.lock);
+      r = user_src ? uvmtouch(myproc()->pagetable, src+i, 0) : -1;
+      acquire(&cons.lock);
+      if(r != 0)
+        break;
+      continue;
+    }
     uartputc(c);
+    i++;
   }
   release(&cons.lock);
 
@@ -82,7 +91,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -111,8 +120,16 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      // as in consolewrite(); put c back meanwhile.
+      cons.r--;
+      release(&cons.lock);
+      r = user_dst ? uvmtouch(myproc()->pagetable, dst, 1) : -1;
+      acquire(&cons.lock);
+      if(r != 0)
+        break;
+      continue;
+    }
 
     dst++;
     --n;
@@ -140,8 +157,10 @@ consoleintr(int c)
   acquire(&cons.lock);
 
   switch(c){
-  case C('P'):  // Print process list.
+  case C('P'):  // Print process list and cache counters.
     procdump();
+    kmemdump();
+    bcachedump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
@@ -1,21 +1,32 @@
 struct buf;
 struct context;
+struct cpage;
 struct file;
 struct inode;
+struct iostat;
+struct mm;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct vmstat;
 
 // bio.c
+extern struct iostat iostat;
+#define IOSTAT(f, n) __sync_fetch_and_add(&iostat.f, (n))
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     breaddata(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bprefetch(uint, uint*, int);
+void            bcachedump(void);
+int             iostat_read(pagetable_t, uint64);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +35,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -43,6 +55,8 @@ struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            iprefetch(struct inode*, uint, uint);
+void            ireclaim(void);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -61,14 +75,34 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_order(int);
+void*           kzalloc(void);
+int             kzfill(void);
+void            kfree_order(void *, int);
+void            kdup(void *);
+int             krefcnt(void *);
+int             kfreepages(void);
+void            kfreeblocks(uint64 *);
 void            kfree(void *);
 void            kinit(void);
+void            kmemdump(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_sync(void);
+
+// pcache.c
+void            pcacheinit(void);
+uint64          pcache_lookup(struct inode*, uint);
+uint64          pcache_read(struct inode*, uint, int);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_drop(struct inode*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -85,9 +119,17 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, struct file**);
+void            kproc(char*, void (*)(void));
+int             clone(uint64, uint64, uint64);
+int             growproc(int, uint64*);
+uint64          procsz(struct proc*);
+int             lazyfault(pagetable_t, uint64);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+void            proc_putvm(pagetable_t, struct mm*, uint64, uint64);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -100,6 +142,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -108,13 +151,21 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopy(char*, char*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             spinning(void);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+void            lockstat_reset(void);
+int             lockstat_read(uint64, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -131,6 +182,14 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapin(pagetable_t, uint64);
+int             swapout(int);
+int             swapcheck(void);
+void            swapdup(uint);
+void            swapfree(uint);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -153,20 +212,43 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// vma.c
+struct vma*     vmafind(struct proc*, uint64);
+struct vma*     vmaoverlap(struct proc*, uint64, uint64);
+int             vmafault(struct proc*, uint64);
+void            vmaprefault(uint64, uint64);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+void            vmadup(struct vma*, struct vma*);
+void            vmaclose(pagetable_t, struct vma*);
+
 // vm.c
+extern struct vmstat vmstat;
+#define VMSTAT(f) __sync_fetch_and_add(&vmstat.f, 1)
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmuser(pagetable_t, pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfill(pagetable_t, uint64, uint64, int);
+int             uvmlazy(pagetable_t, uint64, uint64, int);
+uint64          uvmaddr(pagetable_t, uint64);
+uint64          uvmflags(pagetable_t, uint64);
+int             uvmprivate(pagetable_t);
+int             uvmtouch(pagetable_t, uint64, int);
+int             vmstat_read(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -180,6 +262,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -5,12 +5,26 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int flags2perm(int flags);
 
 int
 exec(char *path, char **argv)
+{
+  return execload(myproc(), path, argv);
+}
+
+// Replace p's user memory with the program at path, run with
+// arguments argv. p is the current process, or a new one that
+// spawn() is setting up and that isn't running yet. Returns
+// argc, or -1 with p unchanged.
+int
+execload(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -18,9 +32,12 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v, tmp;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct mm *oldmm;
+  uint64 oldtrapva;
 
+  memset(vma, 0, sizeof(vma));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -38,7 +55,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments. Nothing is read now; pages
+  // are filled in from ip as they are touched (see vma.c).
+  v = vma;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,21 +67,30 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > MMAPTOP)
       goto bad;
-    sz = sz1;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    if(v == &vma[NVMA])
+      goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v->perm = flags2perm(ph.flags);
+    v->flags = MAP_PRIVATE;
+    v++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->sz;  // if p has no mm
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -108,13 +136,34 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image. If p was one of several
+  // threads, it leaves the others the old address space,
+  // under their lock, so that none of them still takes p
+  // for one of them, as mmap() does.
   oldpagetable = p->pagetable;
+  oldmm = p->mm;
+  oldtrapva = p->trapva;
+  if(oldmm)
+    acquire(&oldmm->lock);
   p->pagetable = pagetable;
+  kvmuser(p->kpagetable, pagetable);
+  sfence_vma();
+  p->mm = 0;
+  p->trapva = TRAPFRAME;
   p->sz = sz;
+  if(oldmm)
+    release(&oldmm->lock);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  p->alarm_interval = 0; // the old handler is gone
+  p->alarm_busy = 0;
+  for(i = 0; i < NVMA; i++){
+    tmp = p->vma[i];
+    p->vma[i] = vma[i];
+    vma[i] = tmp;
+  }
+  vmaclose(oldpagetable, vma);
+  proc_putvm(oldpagetable, oldmm, oldtrapva, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,33 +174,20 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmaclose(0, vma);
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
+// PTE permissions for a segment with ELF flags. The segment
+// is always readable, since RISC-V has no write-only pages.
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+flags2perm(int flags)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
+  int perm = PTE_R;
+
+  if(flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_W;
+  return perm;
 }
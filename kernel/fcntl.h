@@ -3,3 +3,28 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() protection and flags
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+#define PROT_EXEC    0x4
+
+#define MAP_SHARED   0x01
+#define MAP_PRIVATE  0x02
+
+#define MAP_FAILED   ((void *) -1)
+
+// spawn() file actions. They are applied in order to the new
+// process's file descriptors, which start out as copies of
+// the caller's, and end with SPAWN_END.
+#define SPAWN_END    0
+#define SPAWN_DUP    1  // make fd a copy of descriptor arg
+#define SPAWN_CLOSE  2  // close fd
+#define SPAWN_OPEN   3  // open path with mode arg as fd
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
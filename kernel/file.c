@@ -101,6 +101,45 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Sequential read-ahead. A read that starts where the last
+// one ended continues a run, and after it the next f->rawin
+// blocks of the file start into the buffer cache in the
+// background, so that the run's next reads find them there.
+// The window starts at RAMIN blocks and doubles with each read
+// of the run, up to NPREFETCH. Any other read ends the run.
+// Called after f's read of the bytes [off, end).
+// Caller holds f->ip->lock.
+static void
+readahead(struct file *f, uint off, uint end)
+{
+  struct inode *ip = f->ip;
+  uint first, last;
+
+  if(off != f->ranext || f->rawin == 0){
+    // a new run.
+    f->rawin = RAMIN;
+    f->raend = 0;
+  } else if(f->rawin < NPREFETCH){
+    f->rawin *= 2;
+    if(f->rawin > NPREFETCH)
+      f->rawin = NPREFETCH;
+  }
+  f->ranext = end;
+
+  if(end >= ip->size)
+    return;
+  first = (end + BSIZE - 1) / BSIZE;  // after the last block read
+  last = first + f->rawin - 1;
+  if(first < f->raend)
+    first = f->raend;
+  if(last > (ip->size - 1) / BSIZE)
+    last = (ip->size - 1) / BSIZE;
+  if(first > last)
+    return;
+  iprefetch(ip, first, last - first + 1);
+  f->raend = last + 1;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -119,8 +158,10 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, 1, addr, f->off, n)) > 0){
+      readahead(f, f->off, f->off + r);
       f->off += r;
+    }
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -146,25 +187,27 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as much at a time as one transaction can log:
+    // the data blocks, plus the i-node, the indirect block,
+    // up to 2 blocks of the free bitmap, and 2 blocks of slop
+    // for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int extra = 1 + 1 + 2 + 2;
+    int max = (log_maxop() - extra) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nblocks = (n1 + BSIZE - 1) / BSIZE + extra;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nblocks);
 
       if(r < 0)
         break;
@@ -7,6 +7,12 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+
+  // sequential read-ahead, FD_INODE; see readahead() in file.c.
+  // protected by ip->lock, like off.
+  uint ranext;       // offset at which the last read ended
+  uint rawin;        // blocks to read ahead of a sequential read
+  uint raend;        // first block not yet read ahead
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +24,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct cpage *pages; // Cached program pages, see pcache.c
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
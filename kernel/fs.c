@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -263,6 +264,8 @@ iget(uint dev, uint inum)
     panic("iget: no inodes");
 
   ip = empty;
+  if(ip->pages)
+    pcache_drop(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -272,6 +275,20 @@ iget(uint dev, uint inum)
   return ip;
 }
 
+// Drop the cached program pages of inodes that nobody holds,
+// to make room in a full page cache.
+void
+ireclaim(void)
+{
+  struct inode *ip;
+
+  acquire(&icache.lock);
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
+    if(ip->ref == 0 && ip->pages)
+      pcache_drop(ip);
+  release(&icache.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -404,6 +421,22 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Start reading blocks bn to bn+n-1 of ip into the buffer
+// cache, or the first NPREFETCH of them, without waiting.
+// They must exist.
+// Caller must hold ip->lock.
+void
+iprefetch(struct inode *ip, uint bn, uint n)
+{
+  uint i, blockno[NPREFETCH];
+
+  if(n > NPREFETCH)
+    n = NPREFETCH;
+  for(i = 0; i < n; i++)
+    blockno[i] = bmap(ip, bn + i);
+  bprefetch(ip->dev, blockno, n);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -413,6 +446,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  if(ip->pages)
+    pcache_drop(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -463,8 +498,13 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // start reading all the blocks at once, then copy
+  // each out as it arrives.
+  if(n > 0 && (off + n - 1)/BSIZE > off/BSIZE)
+    iprefetch(ip, off/BSIZE, (off + n - 1)/BSIZE - off/BSIZE + 1);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = breaddata(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -499,6 +539,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       n = -1;
       break;
     }
+    if(ip->pages)
+      pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
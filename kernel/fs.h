@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                            free bit map | data blocks | swap area ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,10 +20,23 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of pages of swap space
 };
 
 #define FSMAGIC 0x10203040
 
+// Block numbers per log header block; the first header
+// block holds the count of logged blocks in place of one.
+#define LPB (BSIZE / sizeof(uint))
+
+// Header blocks at the start of a log of n blocks: enough
+// for the count and the block numbers of the rest.
+#define LOGHEADS(n) (((n) + LPB + 1) / (LPB + 1))
+
+// Blocks per page of swap space.
+#define SWAPBLOCKS (4096 / BSIZE)
+
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
@@ -0,0 +1,19 @@
+// Disk and file system event counters, as returned by iostat().
+// Apart from diskmaxdepth, they only ever grow; diff two
+// snapshots to measure a run.
+
+struct iostat {
+  uint64 commits;      // log transactions committed
+  uint64 commitblocks; // blocks they wrote
+  uint64 committime;   // time the flusher spent committing them, in
+                       // timer cycles (10,000,000 a second in qemu)
+  uint64 diskreqs;     // requests sent to the disk
+  uint64 diskblocks;   // blocks they read or wrote
+  uint64 diskdepth;    // requests in flight, summed over each request's
+                       // submission; over diskreqs, the mean queue depth
+  uint64 diskmaxdepth; // most requests ever in flight at once
+  uint64 prefetch;     // blocks bprefetch() started reading
+  uint64 rahit;        // readi() block reads a bprefetch() had read,
+                       // or was reading
+  uint64 ramiss;       // readi() block reads that went to the disk
+};
@@ -1,6 +1,36 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is kept by a binary buddy allocator. A free
+// block of order k is 2^k pages, aligned to its size, and
+// sits on kmem.freelist[k]. kalloc_order(k) splits a bigger
+// block when no block of order k is free; freeing a block
+// merges it with its buddy, the other half of the block of
+// order k+1 the two came from, whenever the buddy is free
+// too. korder[] holds the order of each free block at its
+// first page, which makes that check O(1).
+//
+// Single pages are by far the most common request, so each
+// CPU keeps a private cache of free pages and the common
+// kalloc()/kfree() path only takes a lock that no other CPU
+// normally wants. Pages move between a CPU's cache and the
+// buddy allocator KMEM_BATCH at a time, and only merge once
+// they are back. When both the local cache and the buddy
+// allocator are empty, kalloc() steals half of another
+// CPU's cache.
+//
+// Each CPU's cache also keeps up to KZERO_HIGH pages that
+// are already zeroed, for kzalloc(). The scheduler zeroes
+// them when it has nothing to run (kzfill()), so a fresh
+// user or page-table page usually costs no memset at all.
+//
+// Every page also has a reference count, so that fork() can
+// share pages copy-on-write: kalloc() sets it to 1, kdup()
+// adds a reference, and kfree() only frees the page when the
+// last reference goes. kalloc_order() gives every page of the
+// block one reference, so a block mapped as a superpage can
+// later be shared and freed a page at a time.
 
 #include "types.h"
 #include "param.h"
@@ -9,57 +39,290 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KMEM_BATCH 32               // pages moved to/from the buddy allocator at once
+#define KMEM_HIGH  (2*KMEM_BATCH)   // a CPU cache holding this many gives a batch back
+#define KZERO_HIGH 32               // zeroed pages an idle CPU keeps ready
+
+// Fill freed and newly allocated pages with junk, to catch
+// dangling references and reads of uninitialized memory.
+// The Makefile sets KJUNK=0 for a production kernel.
+#ifndef KJUNK
+#define KJUNK 1
+#endif
+
 void freerange(void *pa_start, void *pa_end);
+static void freepage(void *pa);
+static struct run* zsteal(void);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// A free page or block. prev is only used on the buddy
+// allocator's lists, which blocks are taken off of when
+// their buddy merges with them.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// The buddy allocator, refilled by CPU caches that grow too large.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  int nblock[MAXORDER+1];  // free blocks of each order
+  int nfree;               // pages in all of them
+  uint64 nsplit;           // blocks split in two
+  uint64 nmerge;           // blocks merged with their buddy
 } kmem;
 
+// Per-CPU free-page cache.
+// The lock is only contended when another CPU steals.
+struct kcpu {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  struct run *zerolist;  // zeroed free pages, for kzalloc()
+  int nzero;
+  uint64 nhit;    // kalloc() served from this cache
+  uint64 nmiss;   // kalloc() found this cache empty
+  uint64 nsteal;  // kalloc() refilled from another CPU's cache
+  uint64 nzhit;   // kzalloc() got a zeroed page
+  uint64 nzmiss;  // kzalloc() had to zero one itself
+};
+struct kcpu kcpus[NCPU];
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// References to each physical page; 0 while it is free.
+int kref[NPAGE];
+
+// Order of the free block that starts at each page, or -1
+// if no free block in the buddy allocator starts there.
+char korder[NPAGE];
+
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initticketlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpus[i].lock, "kmem_cpu");
+  memset(korder, -1, sizeof(korder));
   freerange(end, (void*)PHYSTOP);
 }
 
+// Put free block r of the given order on its list.
+// Caller holds kmem.lock.
+static void
+push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  korder[PA2PG(r)] = order;
+  kmem.nblock[order]++;
+  kmem.nfree += 1 << order;
+}
+
+// Take free block r of the given order off its list.
+// Caller holds kmem.lock.
+static void
+unlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  korder[PA2PG(r)] = -1;
+  kmem.nblock[order]--;
+  kmem.nfree -= 1 << order;
+}
+
+// Allocate a block of the given order, splitting the
+// smallest bigger block if there is none; the unused
+// halves go back on the lists. Returns 0 if no block
+// is big enough. Caller holds kmem.lock.
+static struct run*
+bget(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  unlink(r, k);
+  while(k > order){
+    k--;
+    push((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+    kmem.nsplit++;
+  }
+  return r;
+}
+
+// Free block r of the given order, merging it with its
+// buddy for as long as the buddy is free. Physical memory
+// starts at KERNBASE, which is aligned to the biggest block,
+// so a block's buddy is at its address with the bit for the
+// block's size flipped. Caller holds kmem.lock.
+static void
+bput(struct run *r, int order)
+{
+  uint64 buddy;
+
+  while(order < MAXORDER){
+    buddy = (uint64)r ^ ((uint64)PGSIZE << order);
+    if(buddy >= PHYSTOP || korder[PA2PG(buddy)] != order)
+      break;
+    unlink((struct run*)buddy, order);
+    if(buddy < (uint64)r)
+      r = (struct run*)buddy;
+    order++;
+    kmem.nmerge++;
+  }
+  push(r, order);
+}
+
+// Hand every page in [pa_start, pa_end) straight to the
+// buddy allocator, which merges them into blocks.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&kmem.lock);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    if(KJUNK)
+      memset(p, 1, PGSIZE);
+    bput((struct run*)p, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from the buddy allocator into c's cache.
+// Caller holds c->lock. Returns the number of pages moved.
+static int
+refill(struct kcpu *c, int n)
+{
+  struct run *r;
+  int got = 0;
+
+  acquire(&kmem.lock);
+  while(got < n && (r = bget(0)) != 0){
+    r->next = c->freelist;
+    c->freelist = r;
+    got++;
+  }
+  release(&kmem.lock);
+  c->nfree += got;
+  return got;
+}
+
+// Give n pages from c's cache back to the buddy allocator.
+// Caller holds c->lock.
+static void
+drain(struct kcpu *c, int n)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n && (r = c->freelist) != 0; i++){
+    c->freelist = r->next;
+    c->nfree--;
+    bput(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take half of some other CPU's cache and return one page
+// from it; the rest goes into CPU me's cache.
+// Must be called with interrupts off and no kcpu lock held,
+// since only one kcpu lock may be held at a time.
+static struct run*
+steal(int me)
+{
+  struct kcpu *v, *c = &kcpus[me];
+  struct run *head, *tail;
+  int i, j, n;
+
+  for(i = 1; i < NCPU; i++){
+    v = &kcpus[(me + i) % NCPU];
+    acquire(&v->lock);
+    if(v->freelist == 0){
+      release(&v->lock);
+      continue;
+    }
+    n = (v->nfree + 1) / 2;
+    head = tail = v->freelist;
+    for(j = 1; j < n; j++)
+      tail = tail->next;
+    v->freelist = tail->next;
+    v->nfree -= n;
+    release(&v->lock);
+
+    acquire(&c->lock);
+    c->nsteal++;
+    if(n > 1){
+      tail->next = c->freelist;
+      c->freelist = head->next;
+      c->nfree += n - 1;
+    }
+    release(&c->lock);
+    return head;
+  }
+  return 0;
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().  The page goes to this CPU's cache.
 void
 kfree(void *pa)
 {
-  struct run *r;
-
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // Only the last reference frees the page.
+  int ref = __sync_sub_and_fetch(&kref[PA2PG(pa)], 1);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: ref");
+  freepage(pa);
+}
+
+// Put page pa, whose last reference is gone, in this
+// CPU's cache.
+static void
+freepage(void *pa)
+{
+  struct run *r;
+  struct kcpu *c;
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  if(KJUNK)
+    memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = &kcpus[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  if(c->nfree >= KMEM_HIGH)
+    drain(c, KMEM_BATCH);
+  release(&c->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +332,248 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *c;
+  int id;
+
+  push_off();
+  id = cpuid();
+  c = &kcpus[id];
+  acquire(&c->lock);
+  if(c->freelist){
+    c->nhit++;
+  } else {
+    c->nmiss++;
+    refill(c, KMEM_BATCH);
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = steal(id);
+  if(r == 0)
+    r = zsteal();
+  pop_off();
+
+  if(r){
+    kref[PA2PG(r)] = 1;
+    if(KJUNK)
+      memset((char*)r, 5, PGSIZE); // fill with junk
+  }
+  return (void*)r;
+}
+
+// Allocate one page of physical memory, zeroed.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+  struct kcpu *c;
+
+  push_off();
+  c = &kcpus[cpuid()];
+  acquire(&c->lock);
+  if((r = c->zerolist) != 0){
+    c->zerolist = r->next;
+    c->nzero--;
+    c->nzhit++;
+  } else {
+    c->nzmiss++;
+  }
+  release(&c->lock);
+  pop_off();
+
+  if(r){
+    r->next = 0;  // the one word of it the list used
+    kref[PA2PG(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero one free page for this CPU's pool of zeroed pages,
+// unless the pool is full or this CPU's cache and the buddy
+// allocator are out of pages. Called by the scheduler when
+// it has nothing to run, so it does one page at a time.
+// Returns 1 if it zeroed a page, 0 if not.
+int
+kzfill(void)
+{
+  struct run *r;
+  struct kcpu *c;
+
+  push_off();
+  c = &kcpus[cpuid()];
+  acquire(&c->lock);
+  r = 0;
+  if(c->nzero < KZERO_HIGH && (c->freelist || refill(c, KMEM_BATCH))){
+    r = c->freelist;
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  if(r){
+    memset((char*)r, 0, PGSIZE);
+    acquire(&c->lock);
+    r->next = c->zerolist;
+    c->zerolist = r;
+    c->nzero++;
+    release(&c->lock);
+  }
+  pop_off();
+  return r != 0;
+}
+
+// Out of memory but for zeroed pages: take one from any CPU.
+// Must be called with interrupts off and no kcpu lock held.
+static struct run*
+zsteal(void)
+{
+  struct kcpu *c;
+  struct run *r;
+
+  for(c = kcpus; c < &kcpus[NCPU]; c++){
+    acquire(&c->lock);
+    if((r = c->zerolist) != 0){
+      c->zerolist = r->next;
+      c->nzero--;
+    }
+    release(&c->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Allocate 2^order pages of physically contiguous memory,
+// aligned to their size. Each page gets one reference, as
+// from kalloc(). Returns 0 if order is out of range or no
+// free block is big enough.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = bget(order);
   release(&kmem.lock);
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r){
+    for(int i = 0; i < (1 << order); i++)
+      kref[PA2PG(r) + i] = 1;
+    if(KJUNK)
+      memset((char*)r, 5, (uint64)PGSIZE << order); // fill with junk
+  }
   return (void*)r;
 }
+
+// Drop a reference to each page of the block of 2^order
+// pages at pa, which came from kalloc_order(order). If that
+// frees them all, the whole block goes back to the buddy
+// allocator. Otherwise some pages are still shared, and each
+// one freed here goes back on its own, as from kfree().
+void
+kfree_order(void *pa, int order)
+{
+  uint64 last[(1 << MAXORDER) / 64 + 1];  // pages whose last reference was ours
+  int i, ref, nfree = 0;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || ((uint64)pa % ((uint64)PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree_order");
+
+  memset(last, 0, sizeof(last));
+  for(i = 0; i < (1 << order); i++){
+    ref = __sync_sub_and_fetch(&kref[PA2PG(pa) + i], 1);
+    if(ref < 0)
+      panic("kfree_order: ref");
+    if(ref == 0){
+      last[i / 64] |= 1L << (i % 64);
+      nfree++;
+    }
+  }
+
+  if(nfree == (1 << order)){
+    if(KJUNK)
+      memset(pa, 1, (uint64)PGSIZE << order);
+    acquire(&kmem.lock);
+    bput((struct run*)pa, order);
+    release(&kmem.lock);
+    return;
+  }
+  for(i = 0; i < (1 << order); i++)
+    if(last[i / 64] & (1L << (i % 64)))
+      freepage((char*)pa + i*PGSIZE);
+}
+
+// Add a reference to an allocated page.
+void
+kdup(void *pa)
+{
+  if(__sync_fetch_and_add(&kref[PA2PG(pa)], 1) <= 0)
+    panic("kdup");
+}
+
+// Number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&kref[PA2PG(pa)], __ATOMIC_ACQUIRE);
+}
+
+// Number of free pages, for vmstat(). No lock, so only
+// approximate while other CPUs allocate.
+int
+kfreepages(void)
+{
+  int n = kmem.nfree;
+
+  for(struct kcpu *c = kcpus; c < &kcpus[NCPU]; c++)
+    n += c->nfree + c->nzero;
+  return n;
+}
+
+// Number of free blocks of each order in the buddy allocator,
+// for vmstat(); pages in CPU caches aren't counted. Shows how
+// fragmented free memory is. No lock, like kfreepages().
+void
+kfreeblocks(uint64 *nblock)
+{
+  for(int k = 0; k <= MAXORDER; k++)
+    nblock[k] = kmem.nblock[k];
+}
+
+// Print allocator counters to the console.
+// Runs when user types ^P on console. No lock, like procdump().
+void
+kmemdump(void)
+{
+  struct kcpu *c;
+
+  printf("kmem: %d free, split %d merge %d, blocks by order:",
+         kmem.nfree, (int)kmem.nsplit, (int)kmem.nmerge);
+  for(int k = 0; k <= MAXORDER; k++)
+    printf(" %d", kmem.nblock[k]);
+  printf("\n");
+  for(c = kcpus; c < &kcpus[NCPU]; c++){
+    if(c->nhit == 0 && c->nmiss == 0 && c->nfree == 0 && c->nzero == 0)
+      continue;
+    printf("cpu%d: free %d hit %d miss %d steal %d; zeroed %d hit %d miss %d\n",
+           (int)(c - kcpus), c->nfree, (int)c->nhit, (int)c->nmiss, (int)c->nsteal,
+           c->nzero, (int)c->nzhit, (int)c->nzmiss);
+  }
+}
@@ -0,0 +1,12 @@
+// Lock contention statistics, as returned by lockstat().
+// One entry per lock name; all locks sharing a name are summed.
+
+#define LS_READ   0   // copy out the most contended lock classes
+#define LS_RESET  1   // zero all counters
+
+struct lockstat {
+  char name[16];
+  uint64 nacquire;   // acquire() calls
+  uint64 ncontend;   // acquire() calls that found the lock held
+  uint64 nspin;      // test-and-set attempts that failed
+};
@@ -6,12 +6,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only committed when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,19 +20,40 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction has been committed.
+// begin_op() reserves room for MAXOPBLOCKS blocks; a call
+// that writes more, like a big write(), reserves what it
+// needs with begin_opn() and ends with end_opn().
+//
+// Commits are made by a kernel thread, the flusher, not by
+// the system calls (group commit). The flusher closes the
+// open transaction once it has been open COMMITTICKS ticks,
+// has COMMITBLOCKS blocks, or is wanted on disk by fsync()
+// or by a begin_op() short of log space. Closing waits for
+// the transaction's system calls to finish, and copies its
+// blocks aside; a new transaction then opens at once, and
+// system calls join it while the flusher writes the old one
+// to disk. So an FS system call returns before its updates
+// are on disk; fsync() waits for them.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// mkfs chooses its size, and the kernel uses up to LOGSIZE
+// blocks of it. The on-disk log format:
+//   header blocks, as many as the log's size needs, holding
+//     the count of logged blocks and then their block #s
+//     (block A, block B, block C, ...), LPB to a block
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The count is in the first header block, which is written
+// last, so that writing it is the commit.
+// Log appends are synchronous, but commit() hands each stage
+// to the disk as one batch of requests and waits once: the log
+// blocks are consecutive, so they go as one large request, and
+// the home blocks are sorted so that neighbours merge too.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// A transaction's logged block#s, kept in memory until commit.
 struct logheader {
   int n;
   int block[LOGSIZE];
@@ -40,171 +62,349 @@ struct logheader {
 struct log {
   struct spinlock lock;
   int start;
-  int size;
-  int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int size;        // blocks of the log in use, at most LOGSIZE
+  int nhead;       // header blocks at its start
+  int max;         // blocks a transaction may log: size - nhead
   int dev;
+
+  // The open transaction, which FS sys calls join.
+  int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they reserved in begin_opn()
+  int closing;     // flusher is closing it, please wait.
+  uint seq;        // its number; transactions are numbered from 1
+  uint opened;     // ticks when its first block was logged
+  uint want;       // seq of a transaction wanted on disk now
   struct logheader lh;
+
+  // The closed transaction the flusher is writing; private
+  // to the flusher, and to recovery before it starts.
+  uint done;       // seq of the last transaction on disk
+  struct logheader clh;
+  struct buf head[LOGHEADS(LOGSIZE)]; // its header blocks
+  struct buf copy[LOGSIZE]; // its blocks, as they were when it closed
+  struct buf *batch[LOGSIZE]; // bufs for one virtio_disk_rwv()
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog < LOGSIZE ? sb->nlog : LOGSIZE;
+  log.nhead = LOGHEADS(log.size);
+  log.max = log.size - log.nhead;
   log.dev = dev;
+  if (log.max < MAXOPBLOCKS)
+    panic("initlog: log too small");
   recover_from_log();
+  log.seq = 1;
+  kproc("logflush", flusher);
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(int recovering)
+// Word w of the header: the count, then the block#s.
+static uint*
+headword(int w)
+{
+  return (uint*)log.head[w / LPB].data + w % LPB;
+}
+
+// Header blocks that hold a header of n block#s.
+static int
+headblocks(int n)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  return (n + 1 + LPB - 1) / LPB;
+}
+
+// Put clh's count and block#s in the header blocks, and
+// return how many blocks they take.
+static int
+pack_head(void)
+{
+  int i;
+
+  *headword(0) = log.clh.n;
+  for (i = 0; i < log.clh.n; i++)
+    *headword(i+1) = log.clh.block[i];
+  for (i = 0; i < headblocks(log.clh.n); i++) {
+    log.head[i].dev = log.dev;
+    log.head[i].blockno = log.start + i;
   }
+  return headblocks(log.clh.n);
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into clh.
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  int i, n;
+
+  log.head[0].dev = log.dev;
+  log.head[0].blockno = log.start;
+  virtio_disk_rw(&log.head[0], 0);
+  n = *headword(0);
+  if (n < 0 || n > log.max)
+    panic("read_head: bad log header");
+  for (i = 1; i < headblocks(n); i++) {
+    log.head[i].dev = log.dev;
+    log.head[i].blockno = log.start + i;
+    log.batch[i-1] = &log.head[i];
   }
-  brelse(buf);
+  virtio_disk_rwv(log.batch, headblocks(n) - 1, 0);
+  log.clh.n = n;
+  for (i = 0; i < n; i++)
+    log.clh.block[i] = *headword(i+1);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the first header block, which holds clh's count.
+// When the count isn't 0, this is the true point at which
+// the transaction commits.
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  *headword(0) = log.clh.n;
+  log.head[0].dev = log.dev;
+  log.head[0].blockno = log.start;
+  virtio_disk_rw(&log.head[0], 1);
+}
+
+// Write the copies of clh's blocks to their home locations,
+// in block order, as one batch. Unless recovering, unpin
+// them from the cache.
+static void
+install_trans(int recovering)
+{
+  int i, j, n = log.clh.n;
+  struct buf *b;
+
+  for (i = 0; i < n; i++) {
+    b = &log.copy[i];
+    b->dev = log.dev;
+    b->blockno = log.clh.block[i];
+    for (j = i; j > 0 && log.batch[j-1]->blockno > b->blockno; j--)
+      log.batch[j] = log.batch[j-1];
+    log.batch[j] = b;
+  }
+  virtio_disk_rwv(log.batch, n, 1);
+  if (recovering)
+    return;
+  for (i = 0; i < n; i++) {
+    b = bread(log.dev, log.clh.block[i]);
+    bunpin(b);
+    brelse(b);
   }
-  bwrite(buf);
-  brelse(buf);
 }
 
 static void
 recover_from_log(void)
 {
+  int i;
+
   read_head();
+  for (i = 0; i < log.clh.n; i++) {
+    log.copy[i].dev = log.dev;
+    log.copy[i].blockno = log.start + log.nhead + i;
+    log.batch[i] = &log.copy[i];
+  }
+  virtio_disk_rwv(log.batch, log.clh.n, 0);
   install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that logs at
+// most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
   acquire(&log.lock);
+  if(n > log.max)
+    panic("begin_opn: too big");
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.reserved + n > log.max){
+      // this op might exhaust log space; have the flusher
+      // commit the open transaction, and wait.
+      log.want = log.seq;
+      wakeup(&ticks);  // where the flusher naps while a transaction is open
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the end of each FS system call that began
+// with begin_opn(n).
 void
-end_op(void)
+end_opn(int n)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= n;
+  if(log.outstanding < 0 || log.reserved < 0)
+    panic("end_op");
+  if(log.outstanding == 0 && log.closing){
+    // the flusher is waiting for the transaction to quiesce.
+    wakeup(&log.closing);
   }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.reserved has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// The most blocks one FS system call may log, for callers
+// of begin_opn().
+int
+log_maxop(void)
+{
+  return log.max;
+}
+
+// Is the open transaction due to be committed?
+// Caller holds log.lock.
+static int
+commitdue(void)
+{
+  return log.want == log.seq || log.lh.n >= COMMITBLOCKS ||
+    ticks - log.opened >= COMMITTICKS;
+}
+
+// Close the open transaction: wait for its FS sys calls to
+// finish, copy its header and blocks aside for commit(), and
+// open the next one. The copies keep later transactions'
+// updates out of this one's commit.
+// Caller holds log.lock.
+static void
+closetrans(void)
+{
+  int i;
+  struct buf *b;
+
+  log.closing = 1;
+  while(log.outstanding > 0)
+    sleep(&log.closing, &log.lock);
+  release(&log.lock);
+
+  // no sys call can change the blocks until closing is clear.
+  log.clh.n = log.lh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = log.lh.block[i];
+    b = bread(log.dev, log.clh.block[i]);
+    memmove(log.copy[i].data, b->data, BSIZE);
+    brelse(b);
   }
+
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.seq++;
+  log.closing = 0;
+  wakeup(&log);
 }
 
-// Copy modified blocks from cache to log.
+// Write the closed transaction to the log, commit it, and
+// install it, all from the copies closetrans() made: the
+// blocks in the cache may already hold the open transaction's
+// updates. The blocks stay pinned in the cache until they are
+// installed, so that no one reads an old copy from the disk.
 static void
-write_log(void)
+commit(void)
 {
-  int tail;
+  int i, m, nh, n = log.clh.n;
+  uint64 t0 = r_time();
+  struct buf *b;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  // the header blocks after the first, and the log blocks.
+  nh = pack_head();
+  m = 0;
+  for (i = 1; i < nh; i++)
+    log.batch[m++] = &log.head[i];
+  for (i = 0; i < n; i++) {
+    b = &log.copy[i];
+    b->dev = log.dev;
+    b->blockno = log.start + log.nhead + i;
+    log.batch[m++] = b;
   }
+  virtio_disk_rwv(log.batch, m, 1);  // write the log
+  write_head();    // Write the count to disk -- the real commit
+  install_trans(0); // Now install writes to home locations
+  log.clh.n = 0;
+  write_head();    // Erase the transaction from the log
+
+  IOSTAT(commits, 1);
+  IOSTAT(commitblocks, n);
+  IOSTAT(committime, r_time() - t0);
 }
 
+// The flusher kernel thread: commit each transaction once it
+// is due, while the next one fills.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+flusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n == 0){
+      log.want = 0;
+      sleep(&log.lh, &log.lock);  // log_write() wakes us
+      continue;
+    }
+    if(!commitdue()){
+      sleep(&ticks, &log.lock);   // look again next tick, or when wanted
+      continue;
+    }
+    closetrans();
+    release(&log.lock);
+    commit();
+    acquire(&log.lock);
+    log.done = log.seq - 1;
+    wakeup(&log.done);
   }
 }
 
+// Wait until the updates of every FS system call that has
+// finished are on disk. For fsync().
+void
+log_sync(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0){
+    seq = log.seq;
+    log.want = seq;
+    wakeup(&ticks);
+  } else {
+    seq = log.seq - 1;  // the one being written, if any
+  }
+  while(log.done < seq)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// The flusher's commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -216,7 +416,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.max)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -229,8 +429,11 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    if(log.lh.n == 0){
+      log.opened = ticks;
+      wakeup(&log.lh);
+    }
     log.lh.n++;
   }
   release(&log.lock);
 }
-
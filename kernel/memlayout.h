@@ -55,6 +55,13 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// each process's kernel page table also maps the first
+// UVIEWSZ bytes of its user memory at UVIEW, a gigabyte
+// the kernel page table doesn't otherwise use, so that
+// copyin() and copyout() can use plain loads and stores.
+#define UVIEW 0x40000000L
+#define UVIEWSZ 0x40000000L
+
 // User memory layout.
 // Address zero first:
 //   text
@@ -62,6 +69,10 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed files, placed top down from MMAPTOP
+//   THREADFRAME(NTHREAD-1) .. THREADFRAME(1) (clone()d threads' trapframes)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(i) (TRAPFRAME - (i)*PGSIZE)
+#define MMAPTOP THREADFRAME(NTHREAD-1)
@@ -1,13 +1,22 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD      16  // maximum threads sharing an address space
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // file-backed memory regions per process
+#define NCPAGE      256  // pages in the program page cache
+#define MAXORDER     10  // biggest kalloc_order() block is 2^MAXORDER pages
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      2048  // max blocks of on-disk log, header included
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*3)  // size of disk block cache
+#define NPREFETCH    64  // max blocks one bprefetch() reads, and read-ahead window
+#define RAMIN         4  // blocks read ahead at the start of a sequential run
+#define COMMITTICKS   1  // commit a transaction once it is this many ticks old,
+#define COMMITBLOCKS (LOGSIZE/2)  // or has this many blocks
+#define FSSIZE      10000  // size of file system in blocks
+#define NSWAP       49152  // pages of swap space after the file system
 #define MAXPATH      128   // maximum file path name
@@ -0,0 +1,204 @@
+// Page cache for mapped files.
+//
+// exec() maps a program's segments without reading them, and
+// mmap() maps files the same way; pages are read from the file
+// as they are first touched (see vma.c). Pages of file data are
+// kept here, on a list hanging off the inode and keyed by file
+// offset, so every process mapping the same file maps the same
+// physical pages: ten shells share one copy of sh's text.
+//
+// The cache holds one reference (kdup) to each page. Private
+// mappings map pages copy-on-write, so a store always copies
+// the page, as after fork. MAP_SHARED mappings map them
+// writable, and write them back to the file from there.
+// writei() copies what it writes into any cached page holding
+// that part of the file, so read(), write() and shared
+// mappings all see the same data.
+//
+// A file's cached pages are dropped when it is truncated, when
+// its inode cache slot is recycled, and when the cache is full
+// and nothing holds the inode. Processes that mapped a page
+// before that keep it. If that frees nothing, a page that no
+// process maps any more is taken from whatever file holds it.
+// A MAP_SHARED fault that still finds no room fails, since an
+// uncached page would hide its stores from read() and from
+// other processes.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+struct cpage {
+  struct cpage *next;   // next of this inode's pages, or next free
+  struct inode *ip;     // file the page holds part of, 0 if free
+  uint off;             // file offset of the page
+  uint64 pa;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NCPAGE];
+  struct cpage *free;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  for(int i = 0; i < NCPAGE; i++){
+    pcache.page[i].next = pcache.free;
+    pcache.free = &pcache.page[i];
+  }
+}
+
+// Return the cached page of ip at file offset off, with a
+// reference for the caller, or 0 if it isn't cached.
+uint64
+pcache_lookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  for(c = ip->pages; c; c = c->next){
+    if(c->off == off){
+      pa = c->pa;
+      kdup((void*)pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Take a cached page that only the cache holds a reference
+// to, unlinking it from its inode, or return 0 if every page
+// is mapped somewhere. Caller holds pcache.lock, which
+// pcache_lookup() holds while it takes a reference.
+static struct cpage*
+evict(void)
+{
+  struct cpage *c, **pp;
+
+  for(c = pcache.page; c < &pcache.page[NCPAGE]; c++){
+    if(c->ip == 0 || krefcnt((void*)c->pa) != 1)
+      continue;
+    for(pp = &c->ip->pages; *pp != c; pp = &(*pp)->next)
+      ;
+    *pp = c->next;
+    kfree((void*)c->pa);
+    c->ip = 0;
+    return c;
+  }
+  return 0;
+}
+
+// Return a page holding PGSIZE bytes of ip at file offset off,
+// reading it and adding it to the cache if it isn't there.
+// Bytes past the end of the file read as zero.
+// The caller gets a reference to the page, and must not hold
+// ip's lock. If the cache is full of mapped pages, the page
+// is private to the caller, or, if shared is set, because the
+// caller would map it MAP_SHARED, isn't returned at all.
+// Returns 0 if out of memory, the cache is full and shared is
+// set, or off is at or past the end of the file.
+uint64
+pcache_read(struct inode *ip, uint off, int shared)
+{
+  struct cpage *c;
+  char *mem;
+  uint64 pa;
+  int n;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+
+  // Holding ip's lock keeps writei() and other readers of
+  // ip from changing the cache between the check and the add.
+  ilock(ip);
+  if((pa = pcache_lookup(ip, off)) != 0){
+    iunlock(ip);
+    kfree(mem);
+    return pa;
+  }
+  if((n = readi(ip, 0, (uint64)mem, off, PGSIZE)) <= 0){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  acquire(&pcache.lock);
+  if(pcache.free == 0){
+    // Make room by dropping the pages of files nobody is using.
+    release(&pcache.lock);
+    ireclaim();
+    acquire(&pcache.lock);
+  }
+  if((c = pcache.free) != 0)
+    pcache.free = c->next;
+  else
+    c = evict();
+  if(c == 0 && shared){
+    release(&pcache.lock);
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  if(c){
+    c->ip = ip;
+    c->off = off;
+    c->pa = (uint64)mem;
+    c->next = ip->pages;
+    ip->pages = c;
+    kdup(mem);
+  }
+  release(&pcache.lock);
+  iunlock(ip);
+  return (uint64)mem;
+}
+
+// writei() wrote n bytes from src to ip at file offset off;
+// copy them into the cached pages that hold that part of ip.
+// Caller holds ip's lock.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *c;
+  uint lo, hi;
+
+  acquire(&pcache.lock);
+  for(c = ip->pages; c; c = c->next){
+    lo = max(off, c->off);
+    hi = min(off + n, c->off + PGSIZE);
+    if(lo < hi)
+      memmove((char*)c->pa + (lo - c->off), src + (lo - off), hi - lo);
+  }
+  release(&pcache.lock);
+}
+
+// Drop all of ip's cached pages because ip is being truncated,
+// or its slot is being reused for another file.
+// Caller holds ip's lock, or is the only user of ip.
+void
+pcache_drop(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  while((c = ip->pages) != 0){
+    ip->pages = c->next;
+    kfree((void*)c->pa);
+    c->ip = 0;
+    c->next = pcache.free;
+    pcache.free = c;
+  }
+  release(&pcache.lock);
+}
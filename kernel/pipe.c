@@ -76,12 +76,12 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   char ch;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; ){
     while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
       if(pi->readopen == 0 || pr->killed){
         release(&pi->lock);
@@ -90,9 +90,18 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-      break;
+    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1){
+      // the page may be out on swap or not read from its
+      // file yet, which takes sleeping without pi->lock.
+      release(&pi->lock);
+      r = uvmtouch(pr->pagetable, addr + i, 0);
+      acquire(&pi->lock);
+      if(r != 0)
+        break;
+      continue;
+    }
     pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    i++;
   }
   wakeup(&pi->nread);
   release(&pi->lock);
@@ -102,7 +111,7 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
   char ch;
 
@@ -114,12 +123,21 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; ){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    ch = pi->data[pi->nread % PIPESIZE];
+    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1){
+      // as in pipewrite().
+      release(&pi->lock);
+      r = uvmtouch(pr->pagetable, addr + i, 1);
+      acquire(&pi->lock);
+      if(r != 0)
+        break;
+      continue;
+    }
+    pi->nread++;
+    i++;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
@@ -15,9 +15,61 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Per-CPU queue of RUNNABLE processes, linked through
+// p->rqnext. Lock order: p->lock before runq lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;
+};
+struct runq runq[NCPU];
+
+// Number of allocated procs, so an idle scheduler knows
+// whether it is worth spinning for work, and how many of
+// them are kernel threads.
+int nprocs;
+int nkprocs;
+
+// Sleeping processes, hashed by wait channel and linked
+// through p->sqnext, so wakeup() only looks at procs that
+// might be waiting on its channel. Lock order: p->lock
+// before sleepq lock. A queued proc may no longer be
+// sleeping (kill() woke it); wakeup() rechecks under p->lock.
+// Queues are FIFO, so wakeupn() wakes the longest sleepers.
+#define NSLEEPQ 61
+#define SQHASH(chan) (((uint64)(chan) >> 3) % NSLEEPQ)
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc **tailp;   // &last->sqnext, or &head if empty
+};
+struct sleepq sleepq[NSLEEPQ];
+
+// Address spaces shared by clone()d threads. A process gets
+// one at its first clone(); until then p->mm is 0 and p owns
+// its page table outright.
+struct mm mmtab[NPROC];
+
+// futexwait() and futexwake() sleep and wake on the physical
+// address of the futex word, so that every thread agrees on
+// the channel. Both first break copy-on-write on the word's
+// page (see futexpa()), so that a store to it after a fork()
+// can't move the word to a page other than the one a waiter
+// sleeps on. The hashed futex lock makes checking the word
+// and going to sleep atomic with respect to futexwake().
+#define NFUTEXLOCK 13
+#define FUTEXLOCK(pa) (&futexlock[((pa) >> 2) % NFUTEXLOCK])
+struct spinlock futexlock[NFUTEXLOCK];
+
+// Max procs wakeup() collects per pass over a queue.
+#define WAKEBATCH 8
+
 extern void forkret(void);
+static void kprocret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static pagetable_t proc_sharepagetable(struct proc *p, struct proc *q);
 
 extern char trampoline[]; // trampoline.S
 
@@ -28,6 +80,16 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++){
+    initlock(&sleepq[i].lock, "sleepq");
+    sleepq[i].tailp = &sleepq[i].head;
+  }
+  for(int i = 0; i < NPROC; i++)
+    initlock(&mmtab[i].lock, "mm");
+  for(int i = 0; i < NFUTEXLOCK; i++)
+    initlock(&futexlock[i], "futex");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
 
@@ -73,6 +135,119 @@ myproc(void) {
   return p;
 }
 
+// Append p to the run queue of CPU id.
+static void
+runq_push(int id, struct proc *p)
+{
+  struct runq *rq = &runq[id];
+
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Remove and return the first process on CPU id's run queue,
+// or 0 if it is empty.
+static struct proc*
+runq_pop(int id)
+{
+  struct runq *rq = &runq[id];
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Pull a process from the longest run queue other than CPU id's.
+// The lengths are read without locks; a stale guess only costs
+// an empty pop.
+static struct proc*
+runq_steal(int id)
+{
+  int i, best = -1;
+
+  for(i = 0; i < NCPU; i++){
+    if(i != id && runq[i].n > 0 && (best < 0 || runq[i].n > runq[best].n))
+      best = i;
+  }
+  if(best < 0)
+    return 0;
+  return runq_pop(best);
+}
+
+// Mark p RUNNABLE and queue it on this CPU.
+// Caller must hold p->lock, so interrupts are off.
+static void
+setrunnable(struct proc *p)
+{
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  runq_push(cpuid(), p);
+}
+
+// Unlink p from the sleep queue sq it is on.
+// Caller holds sq->lock.
+static void
+sleepq_unlink(struct sleepq *sq, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+    if(*pp == 0)
+      panic("sleepq_unlink");
+  if(p->sqnext == 0)
+    sq->tailp = pp;
+  *pp = p->sqnext;
+  p->sqnext = 0;
+  p->sq = 0;
+}
+
+// Put p on the sleep queue for p->chan.
+// Caller must hold p->lock.
+static void
+sleepq_insert(struct proc *p)
+{
+  struct sleepq *sq = &sleepq[SQHASH(p->chan)];
+
+  acquire(&sq->lock);
+  p->sq = sq;
+  p->sqnext = 0;
+  *sq->tailp = p;
+  sq->tailp = &p->sqnext;
+  release(&sq->lock);
+}
+
+// Take p off its sleep queue, if it is still on one.
+// Caller must hold p->lock.
+static void
+sleepq_remove(struct proc *p)
+{
+  struct sleepq *sq = p->sq;
+
+  if(sq == 0)
+    return;
+  acquire(&sq->lock);
+  if(p->sq == sq)
+    sleepq_unlink(sq, p);
+  release(&sq->lock);
+}
+
 int
 allocpid() {
   int pid;
@@ -87,10 +262,11 @@ allocpid() {
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. The proc gets an empty
+// address space, or if share is set, a place in share's.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
@@ -112,15 +288,28 @@ found:
     release(&p->lock);
     return 0;
   }
+  __sync_fetch_and_add(&nprocs, 1);
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  // An empty user page table, or a thread slot in share's.
+  if(share){
+    p->pagetable = proc_sharepagetable(p, share);
+  } else {
+    p->trapva = TRAPFRAME;
+    p->pagetable = proc_pagetable(p);
+  }
   if(p->pagetable == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
 
+  // A kernel page table with a view of the user memory.
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -136,12 +325,19 @@ found:
 static void
 freeproc(struct proc *p)
 {
-  if(p->trapframe)
+  if(p->trapframe){
     kfree((void*)p->trapframe);
+    __sync_fetch_and_sub(&nprocs, 1);
+  }
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_putvm(p->pagetable, p->mm, p->trapva, p->sz);
   p->pagetable = 0;
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
+  p->mm = 0;
+  p->trapva = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -149,6 +345,11 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->alarm_interval = 0;
+  p->alarm_ticks = 0;
+  p->alarm_busy = 0;
+  p->alarm_handler = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -195,6 +396,79 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
   uvmfree(pagetable, sz);
 }
 
+// Give p's first thread an mm to share, of memory size sz.
+// p's own trapframe is in slot 0, at TRAPFRAME.
+static struct mm*
+mmalloc(uint64 sz)
+{
+  struct mm *mm;
+
+  for(mm = mmtab; mm < &mmtab[NPROC]; mm++){
+    acquire(&mm->lock);
+    if(mm->ref == 0){
+      mm->ref = 1;
+      mm->slots = 1;
+      mm->sz = sz;
+      release(&mm->lock);
+      return mm;
+    }
+    release(&mm->lock);
+  }
+  return 0;
+}
+
+// Map p's trapframe into a free thread slot of q's page
+// table, making p a thread in q's address space.
+static pagetable_t
+proc_sharepagetable(struct proc *p, struct proc *q)
+{
+  struct mm *mm = q->mm;
+  uint64 va;
+  int i;
+
+  acquire(&mm->lock);
+  for(i = 0; i < NTHREAD; i++)
+    if((mm->slots & (1 << i)) == 0)
+      break;
+  va = THREADFRAME(i);
+  if(i == NTHREAD ||
+     mappages(q->pagetable, va, PGSIZE, (uint64)p->trapframe, PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    return 0;
+  }
+  mm->slots |= 1 << i;
+  mm->ref++;
+  p->mm = mm;
+  p->trapva = va;
+  release(&mm->lock);
+  return q->pagetable;
+}
+
+// Drop one user of a page table: unmap its trapframe at
+// trapva, and free the page table and user memory if no
+// other thread is using them. mm is 0 for a page table with
+// a single owner, whose memory size is sz.
+void
+proc_putvm(pagetable_t pagetable, struct mm *mm, uint64 trapva, uint64 sz)
+{
+  int ref;
+
+  if(mm == 0){
+    proc_freepagetable(pagetable, sz);
+    return;
+  }
+  acquire(&mm->lock);
+  uvmunmap(pagetable, trapva, 1, 0);
+  mm->slots &= ~(1 << ((TRAPFRAME - trapva) / PGSIZE));
+  ref = --mm->ref;
+  sz = mm->sz;
+  release(&mm->lock);
+  if(ref == 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, sz);
+  }
+}
+
 // a user program that calls exec("/init")
 // od -t xC initcode
 uchar initcode[] = {
@@ -213,7 +487,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
@@ -228,31 +502,91 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
+// Size of p's user memory. Threads keep theirs in their mm,
+// where growproc() changes it for all of them at once.
+uint64
+procsz(struct proc *p)
+{
+  return p->mm ? p->mm->sz : p->sz;
+}
+
+// Grow or shrink user memory by n bytes, setting *oldsz to
+// the size before.
 // Return 0 on success, -1 on failure.
+// A process with other threads can't shrink: they may be
+// running on other harts with the freed pages still in their
+// TLBs, and there is no way to shoot those entries down.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
-  sz = p->sz;
+  // Threads sharing the address space grow it one at a time.
+  if(mm)
+    acquire(&mm->lock);
+  sz = *oldsz = procsz(p);
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > MMAPTOP || vmaoverlap(p, sz, sz + n)) {
+      if(mm)
+        release(&mm->lock);
       return -1;
     }
+    // Only reserve the address space; pages are filled in
+    // when first touched (see lazyfault()).
+    sz += n;
   } else if(n < 0){
+    if(mm && mm->ref > 1){
+      release(&mm->lock);
+      return -1;
+    }
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  if(mm){
+    mm->sz = sz;
+    release(&mm->lock);
+  } else {
+    p->sz = sz;
+  }
   return 0;
 }
 
+// The current process touched user address va, which isn't
+// mapped in pagetable. Read it back in if it is out on swap,
+// or fill it in if it lies in one of the process's file-backed
+// regions or its lazily grown heap.
+// Returns 0 if va is now mapped.
+int
+lazyfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct mm *mm;
+  int r, super;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return -1;
+  if((r = swapin(pagetable, va)) <= 0)
+    return r;
+  if(vmafind(p, va))
+    return vmafault(p, va);
+  // Threads may touch the same page at once, and must not
+  // race growproc() or each other building page-table pages.
+  // A superpage mustn't cover any file-backed region.
+  if((mm = p->mm) != 0)
+    acquire(&mm->lock);
+  super = vmaoverlap(p, SUPERPGROUNDDOWN(va), SUPERPGROUNDDOWN(va) + SUPERPGSIZE) == 0;
+  r = uvmlazy(pagetable, va, procsz(p), super);
+  if(mm)
+    release(&mm->lock);
+  return r;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -261,19 +595,32 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. If p has threads,
+  // they may be running on other harts, and would go on
+  // storing to pages through TLB entries that copy-on-write
+  // had taken write access from, so copy the pages now.
+  // Their lock keeps them from changing the page table
+  // under us.
+  if((mm = p->mm) != 0)
+    acquire(&mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, procsz(p), mm == 0) < 0){
+    if(mm)
+      release(&mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = procsz(p);
+  vmadup(np->vma, p->vma);
+  if(mm)
+    release(&mm->lock);
 
   np->parent = p;
 
@@ -293,7 +640,116 @@ fork(void)
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the program at path with
+// arguments argv, as fork() followed by exec() in the child
+// would, but without copying the caller's memory only to
+// throw it away. The child gets the open files in ofile,
+// taking over the caller's references to them, and the
+// caller's current directory. Returns the child's pid, or -1
+// leaving ofile to the caller.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  // Loading the program sleeps. Nothing else uses np while it
+  // isn't RUNNABLE and has no parent.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execload(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++)
+    np->ofile[i] = ofile[i];
+  np->cwd = idup(p->cwd);
+
+  acquire(&np->lock);
+  np->parent = p;
+  pid = np->pid;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Start a kernel thread: a process that runs fn() in the
+// kernel and never returns to user space, such as the log
+// flusher. fn must not return.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  __sync_fetch_and_add(&nkprocs, 1);
+  setrunnable(p);
+  release(&p->lock);
+}
+
+// Create a thread: a new process that shares p's address
+// space and starts in fn(arg) on the given user stack. It
+// has its own trapframe, kernel stack and file descriptors
+// (copied as by fork), and wait() reaps it like a child.
+// fn must call exit() rather than return.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Only p can be using its page table, so p->mm is safe
+  // to set without a lock. Its copy-on-write pages become
+  // private first (see uvmprivate()).
+  if(p->mm == 0 &&
+     (uvmprivate(p->pagetable) < 0 || (p->mm = mmalloc(p->sz)) == 0))
+    return -1;
+
+  if((np = allocproc(p)) == 0){
+    return -1;
+  }
+  np->parent = p;
+
+  // start at fn(arg) on the new stack.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack & ~0xfL;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  vmadup(np->vma, p->vma);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  setrunnable(np);
 
   release(&np->lock);
 
@@ -346,6 +802,8 @@ exit(int status)
     }
   }
 
+  vmaclose(p->pagetable, p->vma);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -405,6 +863,7 @@ wait(uint64 addr)
   // wakeups from a child's exit().
   acquire(&p->lock);
 
+ again:
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
@@ -424,6 +883,13 @@ wait(uint64 addr)
                                   sizeof(np->xstate)) < 0) {
             release(&np->lock);
             release(&p->lock);
+            // addr's page may be out on swap, or need
+            // filling in, which takes sleeping without the
+            // locks.
+            if(uvmtouch(p->pagetable, addr, 1) == 0){
+              acquire(&p->lock);
+              goto again;
+            }
             return -1;
           }
           freeproc(np);
@@ -449,7 +915,8 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the first process off this CPU's run queue,
+//    or pull one from the busiest other CPU's queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -458,36 +925,47 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;  // the scheduler thread never migrates
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-    
-    int nproc = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state != UNUSED) {
-        nproc++;
-      }
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+
+    if((p = runq_pop(id)) == 0 && (p = runq_steal(id)) == 0){
+      // Nothing to run: zero a page for kzalloc(), or wait
+      // for an interrupt once there is nothing left to zero.
+      if(kzfill() == 0 && nprocs - nkprocs <= 2) {   // only init and sh exist
+        intr_on();
+        asm volatile("wfi");
       }
-      release(&p->lock);
-    }
-    if(nproc <= 2) {   // only init and sh exist
-      intr_on();
-      asm volatile("wfi");
+      continue;
     }
+
+    // A queued process stays RUNNABLE until a scheduler
+    // pops it, so no one else can run it now.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued proc not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    // Run it on its own kernel page table.
+    p->state = RUNNING;
+    c->proc = p;
+    kvmuser(p->kpagetable, p->pagetable);
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // Leave its page table before releasing p->lock lets
+    // wait() free it.
+    kvminithart();
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -524,7 +1002,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -550,6 +1028,19 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kprocret.
+static void
+kprocret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kproc returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -559,22 +1050,29 @@ sleep(void *chan, struct spinlock *lk)
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once p is on chan's sleep queue and we
+  // hold p->lock, we can be guaranteed that
+  // we won't miss any wakeup (wakeup finds p
+  // on the queue and then locks p->lock),
   // so it's okay to release lk.
   if(lk != &p->lock){  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
   }
 
-  // Go to sleep.
+  // Join chan's sleep queue before releasing lk, so a
+  // wakeup(chan) issued under lk is sure to find p there.
   p->chan = chan;
+  sleepq_insert(p);
+  if(lk != &p->lock)
+    release(lk);
+
+  // Go to sleep.
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
+  // Tidy up. kill() wakes p without dequeuing it.
+  sleepq_remove(p);
   p->chan = 0;
 
   // Reacquire original lock.
@@ -589,15 +1087,102 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+// Wake up to max processes sleeping on chan, longest
+// sleepers first. Returns how many it woke.
+int
+wakeupn(void *chan, int max)
+{
+  struct sleepq *sq = &sleepq[SQHASH(chan)];
+  struct proc *p, *next, *batch[WAKEBATCH];
+  int i, n, more, woken = 0;
+
+  do {
+    // Dequeue up to WAKEBATCH procs waiting on chan. The
+    // sleepq lock can't be held while taking p->lock, so
+    // collect them first and wake them after.
+    n = 0;
+    acquire(&sq->lock);
+    for(p = sq->head; p != 0 && n < WAKEBATCH && woken + n < max; p = next){
+      next = p->sqnext;
+      if(p->chan == chan){
+        sleepq_unlink(sq, p);
+        batch[n++] = p;
+      }
     }
-    release(&p->lock);
+    more = (p != 0);
+    release(&sq->lock);
+
+    for(i = 0; i < n; i++){
+      p = batch[i];
+      acquire(&p->lock);
+      if(p->state == SLEEPING && p->chan == chan) {
+        setrunnable(p);
+        woken++;
+      }
+      release(&p->lock);
+    }
+  } while(more && woken < max);
+  return woken;
+}
+
+// Return the physical address of the futex word at user
+// address addr, on a page of the current process's own, or
+// 0 if addr is bad or isn't writable.
+static uint64
+futexpa(uint64 addr)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0 || uvmaddr(pagetable, addr) == 0 ||
+     uvmcow(pagetable, addr) != 0 || (pa = walkaddr(pagetable, addr)) == 0)
+    return 0;
+  return pa + addr % PGSIZE;
+}
+
+// Sleep on the int at user address addr if it holds val,
+// until futexwake(addr) or kill(). Returns -1 at once if
+// addr is bad or no longer holds val.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+
+  acquire(lk);
+  if(*(int *)pa != val){
+    release(lk);
+    return -1;
   }
+  sleep((void *)pa, lk);
+  release(lk);
+  return p->killed ? -1 : 0;
+}
+
+// Wake up to n threads sleeping in futexwait() on the int at
+// user address addr. Returns how many it woke.
+int
+futexwake(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+
+  acquire(lk);
+  n = wakeupn((void *)pa, n);
+  release(lk);
+  return n;
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -608,7 +1193,8 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    sleepq_remove(p);
+    setrunnable(p);
   }
 }
 
@@ -626,7 +1212,8 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        // sleep() dequeues p when it resumes.
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
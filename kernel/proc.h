@@ -82,6 +82,30 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// An address space shared by threads made with clone().
+// Each thread's trapframe is mapped in its own slot,
+// at THREADFRAME(slot).
+struct mm {
+  struct spinlock lock;
+  int ref;                     // Procs using the address space
+  uint slots;                  // Bit i set if slot i is taken
+  int pins;                    // Threads using their vma tables unlocked
+  uint64 sz;                   // Size of the shared memory (bytes)
+};
+
+// A region of user memory backed by a file, such as a program
+// segment or an mmap(), filled in page by page as it is
+// touched (see vma.c).
+struct vma {
+  uint64 start;                // Page-aligned first address
+  uint64 end;                  // Page-aligned end
+  struct inode *ip;            // Backing file; 0 if the slot is free
+  uint off;                    // File offset of start
+  uint filesz;                 // Bytes backed by the file; the rest is zero
+  int perm;                    // PTE_R, PTE_W, PTE_X
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -94,13 +118,29 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  // runq lock must be held when using this:
+  struct proc *rqnext;         // Next on this CPU's run queue
+
+  // sleepq lock must be held when using these:
+  struct sleepq *sq;           // Sleep queue p is on, if any
+  struct proc *sqnext;         // Next on that sleep queue
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
+  uint64 sz;                   // Size of process memory (bytes), if no mm
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, with a view of user memory
+  struct mm *mm;               // Shared address space, if p has threads
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 trapva;               // Where trapframe is mapped in user space
   struct context context;      // swtch() here to run process
+  void (*kfn)(void);           // What a kernel thread runs; 0 if a user process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // File-backed regions of user memory
   char name[16];               // Process name (debugging)
+  int alarm_interval;          // Ticks between alarm upcalls, 0 if off
+  int alarm_ticks;             // Ticks since the last upcall
+  int alarm_busy;              // In the handler; hold further upcalls
+  uint64 alarm_handler;        // User address of the upcall handler
 };
@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -319,6 +320,14 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// make this hart's instruction fetches see what
+// stores to memory wrote before.
+static inline void
+fence_i()
+{
+  asm volatile("fence.i");
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -326,11 +335,20 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define SUPERPGSIZE (PGSIZE * 512) // bytes mapped by a level-1 leaf PTE
+#define SUPERPGORDER 9             // kalloc_order() of a superpage
+#define SUPERPGROUNDUP(sz)  (((sz)+SUPERPGSIZE-1) & ~(SUPERPGSIZE-1))
+#define SUPERPGROUNDDOWN(a) (((a)) & ~(SUPERPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed; set by the MMU
+#define PTE_D (1L << 7) // dirty; set by the MMU, and by copyout()
+#define PTE_COW (1L << 8) // copy-on-write; software bit
+#define PTE_SHARED (1L << 9) // page of a MAP_SHARED file mapping; software bit
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -339,6 +357,17 @@ sfence_vma()
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// an invalid PTE with PTE_SWAP set stands for a user page that
+// was paged out: it holds the swap slot where the PPN would be,
+// and the page's other flags. see swap.c.
+#define PTE_SWAP (1L << 54)
+#define SLOT2PTE(slot) ((((uint64)(slot)) << 10) | PTE_SWAP)
+#define PTE2SLOT(pte) (((pte) & ~PTE_SWAP) >> 10)
+
+// a valid PTE with any of R, W or X maps memory; one with
+// none points to the next level of page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
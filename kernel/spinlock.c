@@ -7,6 +7,48 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+#define NLOCKCLASS 64
+
+// Delay loop iterations per ticket ahead of ours.
+#define TICKET_BACKOFF 32
+
+// Registry of lock classes, one per lock name.
+// Protected by a bare test-and-set flag, since it
+// cannot itself be a spinlock.
+static struct {
+  uint locked;
+  int n;
+  struct lockclass class[NLOCKCLASS];
+} lockreg;
+
+// Find or create the class for locks called name.
+// Returns 0 if the registry is full; such locks go uncounted.
+static struct lockclass*
+lockclass(char *name)
+{
+  struct lockclass *c;
+
+  push_off();
+  while(__sync_lock_test_and_set(&lockreg.locked, 1) != 0)
+    ;
+  __sync_synchronize();
+  for(c = lockreg.class; c < &lockreg.class[lockreg.n]; c++)
+    if(c->name == name || strncmp(c->name, name, 16) == 0)
+      goto out;
+  if(lockreg.n < NLOCKCLASS){
+    c = &lockreg.class[lockreg.n++];
+    c->name = name;
+  } else {
+    c = 0;
+  }
+out:
+  __sync_synchronize();
+  __sync_lock_release(&lockreg.locked);
+  pop_off();
+  return c;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +56,20 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->nspin = 0;
+  lk->class = lockclass(name);
+  lk->ticket = 0;
+  lk->next = 0;
+  lk->owner = 0;
+}
+
+// Like initlock(), but waiters are served in arrival order.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->ticket = 1;
 }
 
 // Acquire the lock.
@@ -25,12 +81,28 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  uint64 spins = 0;
+  if(lk->ticket){
+    // Take a ticket and wait for it to be served. Each waiter
+    // only reads lk->owner, and backs off in proportion to the
+    // number of CPUs ahead of it, so the owner's cache line is
+    // not hammered. On RISC-V, sync_fetch_and_add is amoadd.w.
+    uint t = __sync_fetch_and_add(&lk->next, 1);
+    uint ahead;
+    while((ahead = t - *(volatile uint *)&lk->owner) != 0){
+      spins++;
+      for(uint i = 0; i < ahead * TICKET_BACKOFF; i++)
+        asm volatile("nop");
+    }
+    lk->locked = 1;
+  } else {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      spins++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +112,18 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  // The class is shared with locks held by other CPUs,
+  // so its counters need atomic adds.
+  lk->nacquire++;
+  lk->nspin += spins;
+  if(lk->class){
+    __sync_fetch_and_add(&lk->class->nacquire, 1);
+    if(spins){
+      __sync_fetch_and_add(&lk->class->ncontend, 1);
+      __sync_fetch_and_add(&lk->class->nspin, spins);
+    }
+  }
 }
 
 // Release the lock.
@@ -66,7 +150,14 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->ticket){
+    // Clear locked before serving the next ticket, or this
+    // store could land after the next owner sets it.
+    lk->locked = 0;
+    __sync_fetch_and_add(&lk->owner, 1);
+  } else {
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
@@ -81,6 +172,19 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// Is the caller holding a spinlock, so that it can't sleep,
+// to read a file or a page from swap?
+int
+spinning(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n > 1;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -108,3 +212,50 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Zero the counters of every lock class.
+void
+lockstat_reset(void)
+{
+  struct lockclass *c;
+
+  for(c = lockreg.class; c < &lockreg.class[lockreg.n]; c++){
+    c->nacquire = 0;
+    c->ncontend = 0;
+    c->nspin = 0;
+  }
+}
+
+// Copy out up to n lock classes to user address addr,
+// most spin iterations first.
+// Returns the number of entries copied, or -1.
+int
+lockstat_read(uint64 addr, int n)
+{
+  struct lockclass *c, *best;
+  struct lockstat st;
+  char done[NLOCKCLASS];
+  int i;
+
+  memset(done, 0, sizeof(done));
+  for(i = 0; i < n && i < lockreg.n; i++){
+    best = 0;
+    for(c = lockreg.class; c < &lockreg.class[lockreg.n]; c++){
+      if(done[c - lockreg.class])
+        continue;
+      if(best == 0 || c->nspin > best->nspin ||
+         (c->nspin == best->nspin && c->nacquire > best->nacquire))
+        best = c;
+    }
+    done[best - lockreg.class] = 1;
+
+    memset(&st, 0, sizeof(st));
+    safestrcpy(st.name, best->name, sizeof(st.name));
+    st.nacquire = best->nacquire;
+    st.ncontend = best->ncontend;
+    st.nspin = best->nspin;
+    if(copyout(myproc()->pagetable, addr + i*sizeof(st), (char*)&st, sizeof(st)) < 0)
+      return -1;
+  }
+  return i;
+}
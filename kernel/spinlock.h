@@ -1,9 +1,29 @@
+// Contention counters shared by every lock with the same name.
+struct lockclass {
+  char *name;
+  uint64 nacquire;   // acquire() calls
+  uint64 ncontend;   // acquire() calls that found the lock held
+  uint64 nspin;      // test-and-set attempts that failed
+};
+
 // Mutual exclusion lock.
+// initlock() makes a test-and-set lock; initticketlock() makes
+// a FIFO ticket lock, for hot locks where fairness matters.
 struct spinlock {
   uint locked;       // Is the lock held?
 
+  // Ticket lock state, if ticket is set:
+  uint ticket;       // Is this a ticket lock?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now being served.
+
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Statistics, updated while holding the lock:
+  uint64 nacquire;
+  uint64 nspin;
+  struct lockclass *class;
 };
 
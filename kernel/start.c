@@ -78,6 +78,9 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
+  // let supervisor mode read the time CSR, for r_time().
+  w_mcounteren(r_mcounteren() | 2);
+
   // enable machine-mode timer interrupts.
   w_mie(r_mie() | MIE_MTIE);
 }
@@ -0,0 +1,293 @@
+// Paging out to swap space.
+//
+// When free memory runs low, swapout() picks cold user pages
+// and writes them to the swap area that mkfs leaves after the
+// file system on the disk. The page's PTE is left invalid,
+// holding the page's swap slot instead (PTE_SWAP), so the next
+// touch of the page faults, and swapin() reads it back into a
+// new page.
+//
+// Cold pages are found with a clock: a hand sweeps over the
+// user page tables of all processes, clearing the PTE_A bit
+// the MMU sets on each access. A page whose bit is still
+// clear when the hand comes round again hasn't been used
+// since, and is paged out. A cold superpage is split first.
+//
+// Only private pages that nothing else maps are paged out:
+// not pages shared after fork(), pages of the page cache or
+// MAP_SHARED pages. Processes with threads are left alone, as
+// are processes running on other CPUs, so that nothing but
+// the process itself uses its pages while they go out.
+//
+// A slot holds its page for every page table that maps it: a
+// process that forks while some of its pages are out shares
+// their slots with the child, and each reads in its own copy.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+#include "vmstat.h"
+
+#define SWAPLOW   512  // page out when fewer pages than this are free,
+#define SWAPBATCH  32  // this many at a time
+
+extern struct proc proc[NPROC];
+
+struct swapout {
+  uint64 pa;
+  uint slot;
+};
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAP];  // page tables holding each slot; 0 if free
+  uint next;         // where to look for a free slot
+
+  // one page goes in or out at a time; protects the rest.
+  struct sleeplock io;
+  uint dev;
+  uint start;        // first block of swap space
+  uint nslot;        // sb's nswap, at most NSWAP; 0 if no swap
+  struct proc *hand; // the clock hand: a process,
+  uint64 handva;     // and an address in it
+  struct buf buf;
+} swap;
+
+// Find the swap area on disk dev, as described by sb.
+// Called by fsinit(). A disk made before swap space was
+// added has none, and then nothing is paged out.
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+  swap.dev = dev;
+  swap.start = sb->swapstart;
+  swap.hand = proc;
+  swap.nslot = sb->nswap < NSWAP ? sb->nswap : NSWAP;
+}
+
+// Allocate a free slot, or return -1 if swap is full.
+static int
+swapalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another page table holds slot; used by uvmcopy().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A page table no longer holds slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Read or write page pa at slot. Caller holds swap.io.
+static void
+swaprw(uint slot, char *pa, int write)
+{
+  struct buf *b = &swap.buf;
+
+  for(int i = 0; i < SWAPBLOCKS; i++){
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot*SWAPBLOCKS + i;
+    if(write)
+      memmove(b->data, pa + i*BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if(!write)
+      memmove(pa + i*BSIZE, b->data, BSIZE);
+  }
+}
+
+// If user page va of pagetable is out on swap, read it back in
+// and map it. Returns 1 if va isn't on swap, 0 if it is now
+// mapped, or -1 if memory ran out or the caller holds a
+// spinlock, so that it can't sleep for the disk.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0 ||
+     (*pte & PTE_SWAP) == 0)
+    return 1;
+  if(spinning() || (mem = kalloc()) == 0)
+    return -1;
+
+  acquiresleep(&swap.io);
+  old = *pte;
+  if((old & PTE_SWAP) == 0){
+    // another thread read it in, or unmapped it.
+    releasesleep(&swap.io);
+    kfree(mem);
+    return (old & PTE_V) ? 0 : -1;
+  }
+  swaprw(PTE2SLOT(old), mem, 0);
+  // mark it used, so the clock doesn't take it straight back.
+  if(!__sync_bool_compare_and_swap(pte, old,
+       PA2PTE(mem) | PTE_FLAGS(old) | PTE_A | PTE_V)){
+    releasesleep(&swap.io);
+    kfree(mem);
+    return -1;
+  }
+  releasesleep(&swap.io);
+  swapfree(PTE2SLOT(old));
+  VMSTAT(swapin);
+  return 0;
+}
+
+// May the clock take p's pages? Caller holds p->lock.
+static int
+swappable(struct proc *p)
+{
+  return (p == myproc() || p->state == SLEEPING || p->state == RUNNABLE) &&
+    p->mm == 0 && p->pagetable != 0;
+}
+
+// Sweep the clock hand over p's user pages from swap.handva,
+// clearing PTE_A bits, and take up to n pages whose bit was
+// already clear: give each a slot, leave the slot in its PTE,
+// and note the page in out[] for the caller to write. Leaves
+// swap.handva where it stopped, or 0 at the end of p's address
+// space. Returns the number of pages taken.
+// Caller holds swap.io and p->lock.
+static int
+sweep(struct proc *p, struct swapout *out, int n)
+{
+  pagetable_t pagetable = p->pagetable;
+  uint64 va = swap.handva;
+  pte_t *pte, old;
+  int m = 0, slot;
+
+  while(va < MAXVA && m < n){
+    pte = &pagetable[PX(2, va)];
+    if((*pte & PTE_V) == 0){
+      va = (va | ((1L << PXSHIFT(2)) - 1)) + 1;
+      continue;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+    if((*pte & PTE_V) == 0){
+      va = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+      continue;
+    }
+    if(PTE_LEAF(*pte)){
+      // a superpage: if it is cold, split it with walk(), and
+      // look at it again as pages.
+      if(*pte & PTE_A)
+        *pte &= ~PTE_A;
+      else if((*pte & PTE_U) && (*pte & PTE_SHARED) == 0 &&
+              krefcnt((void*)PTE2PA(*pte)) == 1 && walk(pagetable, va, 0) != 0)
+        continue;
+      va = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+      continue;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+    old = *pte;
+    if((old & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (old & PTE_SHARED) == 0){
+      if(old & PTE_A){
+        *pte = old & ~PTE_A;
+      } else if(krefcnt((void*)PTE2PA(old)) == 1){
+        if((slot = swapalloc()) < 0)
+          break;
+        *pte = SLOT2PTE(slot) | (PTE_FLAGS(old) & ~(PTE_V|PTE_D));
+        out[m].pa = PTE2PA(old);
+        out[m].slot = slot;
+        m++;
+      }
+    }
+    va += PGSIZE;
+  }
+  swap.handva = va < MAXVA ? va : 0;
+  return m;
+}
+
+// Page out up to n cold user pages, sweeping the clock hand
+// over every process at most twice. Returns the number of
+// pages paged out.
+int
+swapout(int n)
+{
+  struct swapout out[SWAPBATCH];
+  struct proc *p;
+  int i, m = 0;
+
+  if(swap.nslot == 0 || spinning())
+    return 0;
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+
+  acquiresleep(&swap.io);
+  for(i = 0; i < 2*NPROC && m < n; ){
+    p = swap.hand;
+    acquire(&p->lock);
+    if(swappable(p))
+      m += sweep(p, out + m, n - m);
+    else
+      swap.handva = 0;
+    release(&p->lock);
+    if(swap.handva == 0){
+      swap.hand = (p + 1 < &proc[NPROC]) ? p + 1 : proc;
+      i++;
+    } else if(m < n){
+      break;  // out of slots
+    }
+  }
+
+  // The pages may be in this CPU's TLB, if they are the
+  // caller's own, or through the caller's user view.
+  sfence_vma();
+  for(i = 0; i < m; i++){
+    swaprw(out[i].slot, (char*)out[i].pa, 1);
+    kfree((void*)out[i].pa);
+    VMSTAT(swapout);
+  }
+  releasesleep(&swap.io);
+  return m;
+}
+
+// Page out some cold pages if free memory is low. For places
+// that can sleep and aren't using any user pages, like the
+// page fault path. Returns the number of pages paged out.
+int
+swapcheck(void)
+{
+  if(swap.nslot == 0 || kfreepages() >= SWAPLOW)
+    return 0;
+  return swapout(SWAPBATCH);
+}
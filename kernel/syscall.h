@@ -20,3 +20,14 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_lockstat 22
+#define SYS_sigalarm 23
+#define SYS_sigreturn 24
+#define SYS_clone  25
+#define SYS_futex  26
+#define SYS_vmstat 27
+#define SYS_mmap   28
+#define SYS_munmap 29
+#define SYS_spawn  30
+#define SYS_fsync  31
+#define SYS_iostat 32
@@ -75,6 +75,8 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  if(n > 0)
+    vmaprefault(p, n);
   return fileread(f, p, n);
 }
 
@@ -87,6 +89,8 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  if(n > 0)
+    vmaprefault(p, n);
 
   return filewrite(f, p, n);
 }
@@ -115,6 +119,30 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until fd's updates, and all others that have
+// finished, are on disk: there is one log for everything.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// iostat(st) copies out the disk and file system counters.
+uint64
+sys_iostat(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return iostat_read(myproc()->pagetable, addr);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -283,17 +311,13 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open the file at path with mode omode, for open() and
+// spawn(). Returns the open file, or 0.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -301,33 +325,31 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -336,6 +358,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->rawin = 0;
+    f->raend = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -348,6 +373,24 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -412,23 +455,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the argument strings of user argv array uargv into
+// pages of argv[MAXARG], for exec() and spawn(). The caller
+// must free them with freeargv(), even if this fails.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -436,24 +478,112 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
+
+// Set up the open files ofile[NOFILE] of a process that
+// spawn() creates: references to the caller's open files,
+// changed by the list of file actions at user address uact.
+// Returns 0, or -1 having closed them all again.
+static int
+spawnfiles(uint64 uact, struct file **ofile)
+{
+  struct proc *p = myproc();
+  struct spawnact act;
+  char path[MAXPATH];
+  struct file *f;
+  int i;
+
+  for(i = 0; i < NOFILE; i++)
+    ofile[i] = p->ofile[i] ? filedup(p->ofile[i]) : 0;
+
+  for(i = 0; uact != 0; i++){
+    if(i >= 2*NOFILE || copyin(p->pagetable, (char*)&act, uact + i*sizeof(act), sizeof(act)) < 0)
+      goto bad;
+    if(act.op == SPAWN_END)
+      break;
+    if(act.fd < 0 || act.fd >= NOFILE)
+      goto bad;
+    switch(act.op){
+    case SPAWN_DUP:
+      if(act.arg < 0 || act.arg >= NOFILE || ofile[act.arg] == 0)
+        goto bad;
+      f = filedup(ofile[act.arg]);
+      break;
+    case SPAWN_CLOSE:
+      f = 0;
+      break;
+    case SPAWN_OPEN:
+      if(fetchstr((uint64)act.path, path, MAXPATH) < 0 ||
+         (f = openfile(path, act.arg)) == 0)
+        goto bad;
+      break;
+    default:
+      goto bad;
+    }
+    if(ofile[act.fd])
+      fileclose(ofile[act.fd]);
+    ofile[act.fd] = f;
+  }
+  return 0;
 
  bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
   return -1;
 }
 
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *ofile[NOFILE];
+  uint64 uargv, uact;
+  int i, pid = -1;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uact) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0 && spawnfiles(uact, ofile) == 0){
+    if((pid = spawn(path, argv, ofile)) < 0){
+      for(i = 0; i < NOFILE; i++)
+        if(ofile[i])
+          fileclose(ofile[i]);
+    }
+  }
+  freeargv(argv);
+  return pid;
+}
+
 uint64
 sys_pipe(void)
 {
@@ -484,3 +614,28 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off) maps part of an open
+// file into memory; see mmap() in vma.c.
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
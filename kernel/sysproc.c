@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "futex.h"
 
 uint64
 sys_exit(void)
@@ -35,19 +37,20 @@ sys_wait(void)
   uint64 p;
   if(argaddr(0, &p) < 0)
     return -1;
+  if(p != 0)
+    vmaprefault(p, sizeof(int));
   return wait(p);
 }
 
 uint64
 sys_sbrk(void)
 {
-  int addr;
+  uint64 addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -95,3 +98,113 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// lockstat(LS_RESET, 0, 0) zeroes the lock counters;
+// lockstat(LS_READ, st, n) copies out the n most contended
+// lock classes and returns how many it copied.
+uint64
+sys_lockstat(void)
+{
+  int cmd, n;
+  uint64 addr;
+
+  if(argint(0, &cmd) < 0 || argaddr(1, &addr) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(cmd == LS_RESET){
+    lockstat_reset();
+    return 0;
+  }
+  if(cmd != LS_READ || n < 0)
+    return -1;
+  return lockstat_read(addr, n);
+}
+
+// sigalarm(n, fn) calls fn every n ticks of CPU time the
+// process spends in user space; n == 0 turns the alarm off.
+// fn gets a pointer to the interrupted registers, and must
+// finish with sigreturn() on that pointer. upcalls are held
+// until then, or until the next sigalarm().
+uint64
+sys_sigalarm(void)
+{
+  struct proc *p = myproc();
+  int n;
+  uint64 fn;
+
+  if(argint(0, &n) < 0 || argaddr(1, &fn) < 0 || n < 0)
+    return -1;
+  p->alarm_interval = n;
+  p->alarm_handler = fn;
+  p->alarm_ticks = 0;
+  p->alarm_busy = 0;
+  return 0;
+}
+
+// sigreturn(frame) resumes the user registers an alarm upcall
+// saved at frame.
+uint64
+sys_sigreturn(void)
+{
+  struct proc *p = myproc();
+  struct trapframe *tf = p->trapframe;
+  struct trapframe frame;
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  if(copyin(p->pagetable, (char *)&frame, addr, sizeof(frame)) < 0)
+    return -1;
+
+  // usertrapret() refills the kernel_* fields; keep the
+  // user's copies out of them anyway.
+  frame.kernel_satp = tf->kernel_satp;
+  frame.kernel_sp = tf->kernel_sp;
+  frame.kernel_trap = tf->kernel_trap;
+  frame.kernel_hartid = tf->kernel_hartid;
+  *tf = frame;
+  p->alarm_busy = 0;
+
+  // syscall() stores the return value in a0.
+  return tf->a0;
+}
+
+// clone(fn, arg, stack) starts a thread running fn(arg) on
+// stack, in the caller's address space; returns its pid.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+// futex(addr, FUTEX_WAIT, val) sleeps if *addr == val;
+// futex(addr, FUTEX_WAKE, n) wakes up to n of those sleepers
+// and returns how many it woke.
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if(op == FUTEX_WAIT)
+    return futexwait(addr, val);
+  if(op == FUTEX_WAKE)
+    return futexwake(addr, val);
+  return -1;
+}
+
+// vmstat(st) copies out the VM event counters.
+uint64
+sys_vmstat(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return vmstat_read(myproc()->pagetable, addr);
+}
@@ -5,21 +5,25 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vmstat.h"
 
 struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopyfault[], ucopyend[];  // ucopy.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
+static void alarmtick(struct proc *p);
+static int pagefault(pagetable_t pagetable, uint64 va, uint64 scause);
 
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initticketlock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +69,8 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(pagefault(p->pagetable, r_stval(), r_scause()) == 0){
+    // ok
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -77,12 +83,47 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  if(which_dev == 2){
+    alarmtick(p);
     yield();
+  }
+
+  // keep some memory free, by paging out if need be.
+  swapcheck();
 
   usertrapret();
 }
 
+// a timer interrupt arrived from user space. if p's alarm
+// is due, push the interrupted user registers onto its user
+// stack and return to the handler instead, passing it the
+// saved registers; the handler hands them to sigreturn().
+static void
+alarmtick(struct proc *p)
+{
+  struct trapframe *tf = p->trapframe;
+  struct trapframe frame;
+  uint64 sp;
+
+  if(p->alarm_interval == 0 || p->alarm_busy)
+    return;
+  if(++p->alarm_ticks < p->alarm_interval)
+    return;
+
+  frame = *tf;
+  frame.kernel_satp = frame.kernel_sp = frame.kernel_trap = 0;
+  frame.kernel_hartid = 0;
+  sp = (tf->sp - sizeof(frame)) & ~0xfL;
+  if(copyout(p->pagetable, sp, (char *)&frame, sizeof(frame)) < 0)
+    return; // bad user stack; try again next tick
+
+  p->alarm_ticks = 0;
+  p->alarm_busy = 1;
+  tf->epc = p->alarm_handler;
+  tf->sp = sp;
+  tf->a0 = sp;
+}
+
 //
 // return to user space
 //
@@ -125,7 +166,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->trapva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +184,17 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopy && sepc < (uint64)ucopyend){
+    // a fault in copyin() or copyout() on the user view.
+    // retry on the filled-in page, or make the copy fail.
+    uint64 stval = r_stval();
+    if(stval >= UVIEW && stval < UVIEW + UVIEWSZ &&
+       pagefault(myproc()->pagetable, stval - UVIEW, scause) == 0)
+      sfence_vma();
+    else
+      sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -218,3 +269,36 @@ devintr()
   }
 }
 
+// handle a page fault at user address va: the first touch of
+// a lazily allocated or file-backed page, a page out on swap,
+// or a store to a copy-on-write page. scause is 12 for an
+// instruction fetch, 13 for a load and 15 for a store.
+// return 0 if the access can be retried.
+static int
+pagefault(pagetable_t pagetable, uint64 va, uint64 scause)
+{
+  if(scause != 12 && scause != 13 && scause != 15)
+    return -1;
+  VMSTAT(faults);
+  swapcheck();
+  for(int i = 0; i < 4; i++){
+    if(uvmaddr(pagetable, PGROUNDDOWN(va)) != 0){
+      // a fetch from a page mapped without PTE_X would
+      // only fault again.
+      if(scause == 12){
+        if((uvmflags(pagetable, va) & PTE_X) == 0)
+          return -1;
+        // the page may have just been read in from swap
+        // or a file, or filled in, by stores.
+        fence_i();
+        return 0;
+      }
+      if(scause != 15 || uvmcow(pagetable, va) == 0)
+        return 0;
+    }
+    // if memory ran out, page some out and try again.
+    if(swapcheck() == 0)
+      break;
+  }
+  return -1;
+}
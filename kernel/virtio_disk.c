@@ -16,6 +16,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iostat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -56,10 +57,12 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int inflight;    // requests the device hasn't finished.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // b is the buf of a data descriptor; status
+  // is indexed by first descriptor index of chain.
   struct {
     struct buf *b;
     char status;
@@ -184,12 +187,15 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// the most blocks one request moves: a request needs
+// a descriptor for its header and one for its status too.
+#define MAXSEG (NUM-2)
+
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +206,30 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// queue one request that reads or writes the n bufs b[0..n-1],
+// which hold consecutive blocks, for the device to pick up at
+// the next notify. caller holds vdisk_lock.
+static void
+submit(struct buf **b, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = b[0]->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, one or more for the
+  // data, and one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate n+2 descriptors. if they are all in use, let the
+  // device at the requests queued so far, and wait.
+  int idx[MAXSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -237,24 +246,27 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    int d = idx[i+1];
+    disk.desc[d].addr = (uint64) b[i]->data;
+    disk.desc[d].len = BSIZE;
+    if(write)
+      disk.desc[d].flags = 0; // device reads b->data
+    else
+      disk.desc[d].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[d].flags |= VRING_DESC_F_NEXT;
+    disk.desc[d].next = idx[i+2];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+    // record struct buf for virtio_disk_intr().
+    b[i]->disk = 1;
+    disk.info[d].b = b[i];
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].status = 0xff; // device writes 0 on success
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -266,17 +278,65 @@ virtio_disk_rw(struct buf *b, int write)
 
   __sync_synchronize();
 
+  disk.inflight++;
+  IOSTAT(diskreqs, 1);
+  IOSTAT(diskblocks, n);
+  IOSTAT(diskdepth, disk.inflight);
+  if(disk.inflight > iostat.diskmaxdepth)
+    iostat.diskmaxdepth = disk.inflight;
+}
+
+// Start reading or writing the n bufs b[0..n-1], and return
+// without waiting for the disk (though perhaps for free
+// descriptors). When the disk is done with a buf,
+// virtio_disk_intr() clears its disk flag, wakes up anyone
+// waiting in virtio_disk_wait(), and calls the buf's done
+// callback, if it has one. Each run of bufs in b[] that holds
+// consecutive blocks goes to the disk as one request.
+void
+virtio_disk_submit(struct buf **b, int n, int write)
+{
+  int i, j;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && j-i < MAXSEG; j++)
+      if(b[j]->blockno != b[j-1]->blockno + 1)
+        break;
+    submit(b+i, j-i, write);
+  }
+
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// Wait for the disk to finish with b.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// Read or write the n bufs b[0..n-1], and wait for all of them.
+// All the requests are in flight at once.
+void
+virtio_disk_rwv(struct buf **b, int n, int write)
+{
+  virtio_disk_submit(b, n, write);
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(b[i]);
+}
 
-  release(&disk.vdisk_lock);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
 }
 
 void
@@ -304,9 +364,21 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    // disk is done with the bufs of the chain.
+    for(int d = id; ; d = disk.desc[d].next){
+      struct buf *b = disk.info[d].b;
+      if(b){
+        b->disk = 0;
+        disk.info[d].b = 0;
+        wakeup(b);
+        if(b->done)
+          b->done(b);
+      }
+      if((disk.desc[d].flags & VRING_DESC_F_NEXT) == 0)
+        break;
+    }
+    free_chain(id);
+    disk.inflight--;
 
     disk.used_idx += 1;
   }
@@ -3,26 +3,34 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "vmstat.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// Event counters for vmstat(), bumped with atomic adds.
+struct vmstat vmstat;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int demote(pte_t *pte);
+static pte_t *superpte(pagetable_t pagetable, uint64 va);
+
 /*
  * create a direct-map page table for the kernel.
  */
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  kernel_pagetable = (pagetable_t) kzalloc();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -37,6 +45,7 @@ kvminit()
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() maps all but the start with superpages.
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -51,6 +60,39 @@ kvminithart()
 {
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
+
+  // let the kernel load and store through user PTEs,
+  // for the user view at UVIEW.
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// Create a process's kernel page table: a top-level page
+// that shares kernel_pagetable's lower-level pages, so it
+// maps everything the kernel does, including every kernel
+// stack. kvmuser() adds the user view.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpagetable;
+
+  if((kpagetable = (pagetable_t) kalloc()) == 0)
+    return 0;
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  return kpagetable;
+}
+
+// Map the first UVIEWSZ bytes of user page table pagetable
+// at UVIEW in kpagetable, by pointing kpagetable at the
+// page-table page that maps them in pagetable. The two share
+// every page-table page below the top, so a user mapping
+// made, changed or removed by growproc(), fork(), a page
+// fault or munmap() changes the view too; only this one
+// entry needs copying, when p starts to run or exec()
+// replaces pagetable.
+void
+kvmuser(pagetable_t kpagetable, pagetable_t pagetable)
+{
+  kpagetable[PX(2, UVIEW)] = pagetable[0];
 }
 
 // Return the address of the PTE in page table pagetable
@@ -65,7 +107,12 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-static pte_t *
+//
+// A level-1 PTE can also be a leaf, mapping a 2MB superpage.
+// walk() splits a superpage it meets into pages (demote()),
+// so callers only ever see level-0 PTEs, or returns 0 if
+// that runs out of memory.
+pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
   if(va >= MAXVA)
@@ -74,11 +121,12 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte) && demote(pte) < 0)
+        return 0;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -97,6 +145,13 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if(va >= MAXVA)
     return 0;
 
+  // Look inside a superpage without splitting it.
+  if((pte = superpte(pagetable, va)) != 0){
+    if((*pte & PTE_U) == 0)
+      return 0;
+    return PTE2PA(*pte) + (PGROUNDDOWN(va) - SUPERPGROUNDDOWN(va));
+  }
+
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     return 0;
@@ -108,6 +163,62 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Return the level-1 PTE for va, allocating a level-1
+// page-table page if alloc != 0 and there is none, or
+// 0 if there is none. The PTE may be invalid, a superpage
+// leaf, or point to a level-0 page-table page.
+static pte_t *
+walksuper(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if((*pte & PTE_V) == 0){
+    if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+}
+
+// Return the leaf PTE of the superpage that maps va,
+// or 0 if va is not in a superpage.
+static pte_t *
+superpte(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA || (pte = walksuper(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  return pte;
+}
+
+// Split the superpage leaf *pte into a level-0 page-table
+// page of PTEs that map its pages with the same flags, so
+// part of it can be unmapped, copied or protected on its
+// own. The pages keep their references. Threads may split
+// the same superpage at once, so the PTE is replaced by
+// compare-and-swap, and the loser's page is dropped.
+// The mapping is unchanged, so no TLB flush is needed.
+// Returns -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pt;
+  pte_t old = *pte;
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(PTE2PA(old) + i*PGSIZE) | PTE_FLAGS(old);
+  if(__sync_bool_compare_and_swap(pte, old, PA2PTE(pt) | PTE_V))
+    VMSTAT(demote);
+  else
+    kfree(pt);
+  return 0;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -120,7 +231,9 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where both va and pa are at a superpage
+// boundary and a whole superpage remains to be mapped, maps
+// a superpage. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -131,6 +244,19 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walksuper(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if(last - a == SUPERPGSIZE - PGSIZE)
+        break;
+      a += SUPERPGSIZE;
+      pa += SUPERPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -145,8 +271,11 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never mapped, like untouched
+// pages of a lazily grown heap, are skipped. A superpage
+// that is only partly removed is split first.
+// Optionally free the physical memory, and the swap slots of
+// pages that are out on swap.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
@@ -157,10 +286,24 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = superpte(pagetable, a)) != 0 && a % SUPERPGSIZE == 0 &&
+       a + SUPERPGSIZE <= va + npages*PGSIZE){
+      if(do_free)
+        kfree_order((void*)PTE2PA(*pte), SUPERPGORDER);
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if((pte = walk(pagetable, a, 0)) == 0 && superpte(pagetable, a))
+      panic("uvmunmap: can't split superpage");
+    if(pte != 0 && (*pte & PTE_SWAP)){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -177,10 +320,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -194,8 +336,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -213,12 +354,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -278,32 +418,78 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// If cow is set, the pages themselves are shared: writable
+// pages become read-only copy-on-write pages in both page
+// tables, and the first store through either one copies the
+// page (see uvmcow()). Otherwise the child gets its own copy
+// of each page now and old's PTEs aren't touched, for a parent
+// whose threads may be storing through writable TLB entries
+// on other harts. Pages of MAP_SHARED mappings stay writable
+// and shared. Holes in a lazily grown heap stay holes, and
+// pages out on swap share their slot.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz, int cow)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
+    if((pte = superpte(old, i)) != 0){
+      if((npte = walksuper(new, i, 1)) == 0)
+        goto err;
+      pa = PTE2PA(*pte);
+      if(!cow && (*pte & PTE_SHARED) == 0){
+        if((mem = kalloc_order(SUPERPGORDER)) == 0)
+          goto err;
+        memmove(mem, (char*)pa, SUPERPGSIZE);
+        *npte = PA2PTE(mem) | PTE_FLAGS(*pte);
+        i += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      *npte = *pte;
+      for(int j = 0; j < SUPERPGSIZE / PGSIZE; j++)
+        kdup((void*)(pa + j*PGSIZE));
+      VMSTAT(cowshare);
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
+    if(*pte & PTE_SWAP){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    if(!cow && (flags & PTE_SHARED) == 0){
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+      if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        goto err;
+      }
+      continue;
     }
+    if((flags & PTE_W) && (flags & PTE_SHARED) == 0){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      flags = PTE_FLAGS(*pte);
+    }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kdup((void*)pa);
+    VMSTAT(cowshare);
   }
   return 0;
 
@@ -312,8 +498,233 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Prepare the user page at va for a store, and mark it dirty.
+// If it is a copy-on-write page, give pagetable a private
+// writable copy, or just make it writable if nothing else maps
+// it any more.
+// Returns 0 if the page is now writable, -1 if va is not a
+// writable or copy-on-write user page, or memory ran out.
+//
+// Threads sharing pagetable may fault on the same page at
+// once, so the PTE is only updated by compare-and-swap.
+// Other harts' TLBs aren't shot down, so a copy is only safe
+// without threads: a threaded process's copy-on-write pages
+// all have just the one reference (see uvmprivate()), and
+// only get PTE_W added, which costs a thread with a stale
+// entry no more than a fault.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  // A store to a writable superpage doesn't split it.
+  if((pte = superpte(pagetable, va)) != 0 && (*pte & PTE_W) && (*pte & PTE_U)){
+    if((*pte & PTE_D) == 0)
+      __sync_fetch_and_or(pte, PTE_D);
+    return 0;
+  }
+  if((pte = walk(pagetable, PGROUNDDOWN(va), 0)) == 0)
+    return -1;
+
+again:
+  old = *pte;
+  if((old & PTE_V) == 0 || (old & PTE_U) == 0)
+    return -1;
+  if(old & PTE_W){
+    // copyout() stores through the kernel's mapping, which
+    // doesn't set the user PTE's dirty bit.
+    if((old & PTE_D) == 0)
+      __sync_fetch_and_or(pte, PTE_D);
+    return 0;
+  }
+  if((old & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(old);
+
+  if(krefcnt((void*)pa) == 1){
+    if(!__sync_bool_compare_and_swap(pte, old, (old & ~PTE_COW) | PTE_W))
+      goto again;
+    VMSTAT(cowreuse);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  if(!__sync_bool_compare_and_swap(pte, old,
+       PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_COW) | PTE_W)){
+    kfree(mem);
+    goto again;
+  }
+  kfree((void*)pa);
+  VMSTAT(cowcopy);
+  return 0;
+}
+
+// Map page pa at user address va for a page fault, unless
+// something is mapped there already, such as a page a racing
+// thread filled in first, in which case pa is dropped.
+// Returns 0 if pa was mapped, 1 if va was already mapped for
+// the user, and -1 (dropping pa) if it can't be, or va is out
+// on swap (see swapin()).
+// The caller serializes this with other changes to pagetable.
+int
+uvmfill(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  va = PGROUNDDOWN(va);
+  if((pte = superpte(pagetable, va)) != 0 ||
+     ((pte = walk(pagetable, va, 0)) != 0 && (*pte & (PTE_V|PTE_SWAP)))){
+    kfree((void*)pa);
+    return (*pte & PTE_V) && (*pte & PTE_U) ? 1 : -1;
+  }
+  if(mappages(pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Fill in the page at va of a heap that growproc() grew to sz
+// without allocating, on its first touch. If super is set and
+// the whole superpage around va lies in the heap with nothing
+// mapped in it yet, maps a zeroed superpage there instead, if
+// one is free. Returns 0 if va is now mapped for the user, -1
+// if it is outside the heap, is mapped without PTE_U (the stack
+// guard page), or memory ran out.
+// The caller serializes this with other changes to pagetable.
+int
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 sz, int super)
+{
+  uint64 a = SUPERPGROUNDDOWN(va);
+  pte_t *pte;
+  char *mem;
+  int r;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  if(super && a + SUPERPGSIZE <= sz && (pte = walksuper(pagetable, a, 1)) != 0 &&
+     (*pte & PTE_V) == 0 && (mem = kalloc_order(SUPERPGORDER)) != 0){
+    memset(mem, 0, SUPERPGSIZE);
+    *pte = PA2PTE(mem) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_V;
+    VMSTAT(superfill);
+    return 0;
+  }
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if((r = uvmfill(pagetable, va, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U)) == 0)
+    VMSTAT(lazyfill);
+  return r < 0 ? -1 : 0;
+}
+
+// Make user page va ready for the kernel to copy to (if write
+// is set) or from, as a page fault would: read it back in from
+// swap or its file, fill it in, or break copy-on-write. For
+// copies that failed under a spinlock, since all of that may
+// sleep; the caller retries without the lock. Returns 0 if
+// the copy can succeed now.
+int
+uvmtouch(pagetable_t pagetable, uint64 va, int write)
+{
+  if(uvmaddr(pagetable, PGROUNDDOWN(va)) == 0)
+    return -1;
+  return write ? uvmcow(pagetable, va) : 0;
+}
+
+// Break copy-on-write on every page of pagetable, so that each
+// is private and writable. For clone(), before a process gets
+// its first thread: breaking copy-on-write changes a PTE that
+// threads on other harts may have cached, and nothing shoots
+// their TLB entries down, so a threaded process must have no
+// copy-on-write pages. Returns -1 if memory ran out.
+int
+uvmprivate(pagetable_t pagetable)
+{
+  pte_t *l2, *l1;
+  pagetable_t l0;
+  uint64 va;
+  int i, j, k;
+
+  for(i = 0; i < 512; i++){
+    l2 = &pagetable[i];
+    if((*l2 & PTE_V) == 0 || PTE_LEAF(*l2))
+      continue;
+    for(j = 0; j < 512; j++){
+      l1 = &((pagetable_t)PTE2PA(*l2))[j];
+      va = ((uint64)i << PXSHIFT(2)) | ((uint64)j << PXSHIFT(1));
+      if((*l1 & PTE_V) == 0)
+        continue;
+      if(PTE_LEAF(*l1)){
+        // uvmcow() splits the superpage at its first page.
+        if(*l1 & PTE_COW)
+          for(k = 0; k < 512; k++)
+            if(uvmcow(pagetable, va + k*PGSIZE) != 0)
+              return -1;
+        continue;
+      }
+      l0 = (pagetable_t)PTE2PA(*l1);
+      for(k = 0; k < 512; k++)
+        if((l0[k] & (PTE_V|PTE_COW)) == (PTE_V|PTE_COW) &&
+           uvmcow(pagetable, va + k*PGSIZE) != 0)
+          return -1;
+    }
+  }
+  return 0;
+}
+
+// Look up user page va0 like walkaddr(), but first fill it in
+// if it is an untouched page of the current process's heap.
+// For system calls handed heap memory the process hasn't used.
+uint64
+uvmaddr(pagetable_t pagetable, uint64 va0)
+{
+  uint64 pa;
+
+  if((pa = walkaddr(pagetable, va0)) == 0 && lazyfault(pagetable, va0) == 0)
+    pa = walkaddr(pagetable, va0);
+  return pa;
+}
+
+// Return the PTE flags of user page va, or 0 if it
+// isn't mapped for the user. Doesn't split superpages.
+uint64
+uvmflags(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  if((pte = superpte(pagetable, va)) == 0 && (pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  return PTE_FLAGS(*pte);
+}
+
+// Copy the VM event counters out to user address addr.
+int
+vmstat_read(pagetable_t pagetable, uint64 addr)
+{
+  struct vmstat st = vmstat;
+
+  st.freepages = kfreepages();
+  kfreeblocks(st.freeblocks);
+
+  return copyout(pagetable, addr, (char *)&st, sizeof(st));
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// the kernel can reach non-user pages through the user
+// view, so take away read and write access too: copyin()
+// and copyout() on the guard page still fail. PTE_X stays,
+// to keep the PTE a leaf, and the kernel never fetches
+// instructions from it.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -322,7 +733,20 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U | PTE_W | PTE_R)) | PTE_X;
+}
+
+// Can [va, va+len) in pagetable be reached through the
+// current process's user view? The view holds only the
+// current process's memory, and only below UVIEWSZ.
+static int
+uview(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable &&
+    (pagetable[0] & PTE_V) && p->kpagetable[PX(2, UVIEW)] == pagetable[0] &&
+    va < UVIEWSZ && len <= UVIEWSZ - va;
 }
 
 // Copy from kernel to user.
@@ -333,15 +757,26 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uview(pagetable, dstva, len))
+    return ucopy((char *)(UVIEW + dstva), src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
+    if(uvmaddr(pagetable, va0) == 0 || uvmcow(pagetable, va0) < 0)
+      return -1;
+    // stay on the CPU while using pa0, so that swapout()
+    // can't take the page meanwhile.
+    push_off();
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0){
+      pop_off();
       return -1;
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    pop_off();
 
     len -= n;
     src += n;
@@ -358,15 +793,25 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uview(pagetable, srcva, len))
+    return ucopy(dst, (char *)(UVIEW + srcva), len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
+    if(uvmaddr(pagetable, va0) == 0)
+      return -1;
+    // as in copyout().
+    push_off();
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0){
+      pop_off();
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    pop_off();
 
     len -= n;
     dst += n;
@@ -385,11 +830,23 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(uview(pagetable, srcva, 1)){
+    if(max > UVIEWSZ - srcva)
+      max = UVIEWSZ - srcva;
+    return ucopystr(dst, (char *)(UVIEW + srcva), max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
+    if(uvmaddr(pagetable, va0) == 0)
+      return -1;
+    // as in copyout().
+    push_off();
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0){
+      pop_off();
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -408,6 +865,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    pop_off();
 
     srcva = va0 + PGSIZE;
   }
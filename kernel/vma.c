@@ -0,0 +1,475 @@
+// File-backed regions of user memory.
+//
+// exec() describes each loadable program segment with a vma
+// rather than reading it in, and mmap() adds one for each
+// mapped file. The page fault path fills in a page when the
+// process first touches it:
+//  - whole pages of file data come from the page cache
+//    (pcache.c), mapped copy-on-write if the region is private
+//    and writable (copied at once if the process has threads),
+//    or writable and shared if it is MAP_SHARED;
+//  - the last, partial page of a private region is read into a
+//    private page, as a program's data may be followed by
+//    other things in its file;
+//  - the rest of the region (bss) is zero-filled.
+// Dirty MAP_SHARED pages are written back to the file when
+// they are unmapped, and when the process exits or execs.
+//
+// Each process has its own vma table, holding a reference to
+// each backing inode. Threads get a copy from clone(), like
+// fork(), and mmap() changes every thread's copy in the same
+// way under the mm lock, so the copies stay the same; munmap()
+// refuses while there are other threads. A thread that uses its table without that lock, to
+// fill pages in, pins it so that no other thread changes it
+// meanwhile.
+
+#include "types.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+#include "vmstat.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+extern struct proc proc[NPROC];
+
+// Keep other threads from changing p's vma table while p uses
+// it without holding p->mm->lock.
+static void
+vmapin(struct proc *p)
+{
+  if(p->mm){
+    acquire(&p->mm->lock);
+    p->mm->pins++;
+    release(&p->mm->lock);
+  }
+}
+
+static void
+vmaunpin(struct proc *p)
+{
+  if(p->mm){
+    acquire(&p->mm->lock);
+    p->mm->pins--;
+    release(&p->mm->lock);
+  }
+}
+
+// Lock p's vma tables for a change, waiting until no thread
+// has them pinned.
+static void
+vmalock(struct proc *p)
+{
+  if(p->mm){
+    acquire(&p->mm->lock);
+    while(p->mm->pins > 0){
+      release(&p->mm->lock);
+      yield();
+      acquire(&p->mm->lock);
+    }
+  }
+}
+
+static void
+vmaunlock(struct proc *p)
+{
+  if(p->mm)
+    release(&p->mm->lock);
+}
+
+// Does q share p's vma table?
+static int
+samevm(struct proc *p, struct proc *q)
+{
+  return q == p || (p->mm && q->mm == p->mm);
+}
+
+// Return p's region containing va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return a region of p overlapping [start, end), or 0.
+struct vma*
+vmaoverlap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && start < v->end && end > v->start)
+      return v;
+  return 0;
+}
+
+// Fill in the page at va of region v of p.
+static int
+vmafill(struct proc *p, struct vma *v, uint64 va)
+{
+  uint64 off, pa;
+  uint n;
+  int perm = v->perm | PTE_U;
+  char *mem;
+  int r;
+
+  va = PGROUNDDOWN(va);
+  off = va - v->start;
+  n = off < v->filesz ? v->filesz - off : 0;
+
+  if(n >= PGSIZE || (n > 0 && (v->flags & MAP_SHARED))){
+    // File data: map the shared cached copy.
+    if((pa = pcache_lookup(v->ip, v->off + off)) != 0)
+      VMSTAT(filecached);
+    else if(spinning() ||
+            (pa = pcache_read(v->ip, v->off + off, v->flags & MAP_SHARED)) == 0)
+      return -1;
+    if(v->flags & MAP_SHARED){
+      perm |= PTE_SHARED;
+    } else if((perm & PTE_W) && p->mm){
+      // a threaded process gets no copy-on-write pages (see
+      // uvmprivate()), so copy the page now.
+      if((mem = kalloc()) == 0){
+        kfree((void*)pa);
+        return -1;
+      }
+      memmove(mem, (char*)pa, PGSIZE);
+      kfree((void*)pa);
+      pa = (uint64)mem;
+    } else if(perm & PTE_W){
+      perm = (perm & ~PTE_W) | PTE_COW;
+    }
+  } else {
+    // The end of a private region's file data, then zeros.
+    if(n > 0 && spinning())
+      return -1;
+    if((mem = kzalloc()) == 0)
+      return -1;
+    if(n > 0){
+      ilock(v->ip);
+      r = readi(v->ip, 0, (uint64)mem, v->off + off, n);
+      iunlock(v->ip);
+      if(r != n){
+        kfree(mem);
+        return -1;
+      }
+    }
+    pa = (uint64)mem;
+  }
+
+  if(p->mm)
+    acquire(&p->mm->lock);
+  if((r = uvmfill(p->pagetable, va, pa, perm)) == 0)
+    VMSTAT(filefill);
+  if(p->mm)
+    release(&p->mm->lock);
+  return r < 0 ? -1 : 0;
+}
+
+// Fill in the page at va, which p touched for the first time,
+// if va lies in one of p's regions. Returns 0 if va is now
+// mapped. May read the file and sleep, unless the caller holds
+// a spinlock, in which case only pages that need no reading
+// are filled and the rest fail.
+int
+vmafault(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  int r = -1;
+
+  vmapin(p);
+  if((v = vmafind(p, va)) != 0)
+    r = vmafill(p, v, va);
+  vmaunpin(p);
+  return r;
+}
+
+// Fill in any untouched file-backed pages of the current
+// process in [va, va+n) ahead of a system call that will copy
+// to or from them while holding a lock, and so can't read
+// them from the file then: pipes and the console hold
+// spinlocks, and read() holds the lock of the inode it reads,
+// which may be the program's own.
+void
+vmaprefault(uint64 va, uint64 n)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, end;
+
+  vmapin(p);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0)
+      continue;
+    end = min(va + n, v->end);
+    for(a = max(PGROUNDDOWN(va), v->start); a < end; a += PGSIZE)
+      if(walkaddr(p->pagetable, a) == 0)
+        vmafill(p, v, a);
+  }
+  vmaunpin(p);
+}
+
+// Write the dirty pages of shared region v in [start, end)
+// back to its file. Only bytes still inside the file are
+// written; a mapping never extends its file.
+static void
+writeback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  // as in filewrite(), a few blocks per transaction.
+  uint chunk = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 va, pa;
+  uint off, i, n;
+  pte_t *pte;
+
+  for(va = start; va < end; va += PGSIZE){
+    pte = walk(pagetable, va, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_SHARED|PTE_D)) != (PTE_V|PTE_SHARED|PTE_D))
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (va - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      begin_op();
+      ilock(v->ip);
+      n = 0;
+      if(off + i < v->ip->size){
+        n = min(min(chunk, PGSIZE - i), v->ip->size - (off + i));
+        writei(v->ip, 0, pa + i, off + i, n);
+      }
+      iunlock(v->ip);
+      end_op();
+      if(n == 0)
+        break;
+    }
+  }
+}
+
+// Move the start of region v up to start.
+static void
+vmaadvance(struct vma *v, uint64 start)
+{
+  uint64 d = start - v->start;
+
+  v->off += d;
+  v->filesz = v->filesz > d ? v->filesz - d : 0;
+  v->start = start;
+}
+
+// Cut [lo, hi) out of region v, which contains it. If that
+// leaves a piece above hi as well as below lo, the upper piece
+// goes in w. Returns v's inode if nothing is left of v, for the
+// caller to iput().
+static struct inode*
+vmacut(struct vma *v, struct vma *w, uint64 lo, uint64 hi)
+{
+  struct inode *ip;
+
+  if(lo > v->start && hi < v->end){
+    *w = *v;
+    idup(w->ip);
+    vmaadvance(w, hi);
+    v->end = lo;
+  } else if(lo > v->start){
+    v->end = lo;
+  } else if(hi < v->end){
+    vmaadvance(v, hi);
+  } else {
+    ip = v->ip;
+    v->ip = 0;
+    return ip;
+  }
+  return 0;
+}
+
+// Map len bytes of file f, from file offset off, into the
+// current process, at addr if that range is free and addr is
+// nonzero, else wherever there is room below MMAPTOP.
+// Returns the address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc(), *q;
+  struct vma *v, nv;
+  uint size;
+  int i;
+
+  if(len == 0 || off % PGSIZE != 0 || off + len < off)
+    return -1;
+  if(prot == 0 || (prot & ~(PROT_READ|PROT_WRITE|PROT_EXEC)) != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  ilock(f->ip);
+  size = f->ip->size;
+  if(f->ip->type != T_FILE){
+    iunlock(f->ip);
+    return -1;
+  }
+  iunlock(f->ip);
+
+  // RISC-V has no write-only or execute-only user pages,
+  // so every mapping is readable.
+  len = PGROUNDUP(len);
+  nv.ip = f->ip;
+  nv.off = off;
+  nv.filesz = off < size ? min(len, size - off) : 0;
+  nv.perm = PTE_R;
+  if(prot & PROT_WRITE)
+    nv.perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    nv.perm |= PTE_X;
+  nv.flags = flags;
+
+  vmalock(p);
+  for(i = 0; i < NVMA && p->vma[i].ip; i++)
+    ;
+  if(i == NVMA)
+    goto bad;
+
+  // Search down from MMAPTOP for a gap above the heap.
+  if(addr % PGSIZE != 0 || addr < PGROUNDUP(procsz(p)) || addr + len > MMAPTOP ||
+     addr + len < addr || vmaoverlap(p, addr, addr + len))
+    addr = MMAPTOP - len;
+  while(addr >= PGROUNDUP(procsz(p)) && addr < MMAPTOP &&
+        (v = vmaoverlap(p, addr, addr + len)) != 0)
+    addr = v->start - len;
+  if(addr < PGROUNDUP(procsz(p)) || addr >= MMAPTOP)
+    goto bad;
+  nv.start = addr;
+  nv.end = addr + len;
+
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(samevm(p, q)){
+      q->vma[i] = nv;
+      idup(nv.ip);
+    }
+  }
+  vmaunlock(p);
+  return addr;
+
+ bad:
+  vmaunlock(p);
+  return -1;
+}
+
+// Remove any mappings in [addr, addr+len), writing back dirty
+// shared pages first. addr must be page-aligned.
+// Returns 0, or -1 if addr is bad or splitting a region would
+// need a free vma slot and there isn't one.
+// Like sbrk(-n) (see growproc()), it fails while p has other
+// threads: they may be running on other harts with the freed
+// pages in their TLBs. That also means nobody can store to a
+// page between its writeback and its unmapping: only p could
+// make another thread meanwhile.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc(), *q;
+  struct inode *put[NTHREAD];
+  struct vma *v;
+  uint64 end, lo, hi;
+  int i, j, n;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  vmalock(p);
+  if(p->mm && p->mm->ref > 1){
+    vmaunlock(p);
+    return -1;
+  }
+  vmaunlock(p);
+
+  vmapin(p);
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && (v->flags & MAP_SHARED) && addr < v->end && end > v->start)
+      writeback(p->pagetable, v, max(addr, v->start), min(end, v->end));
+  vmaunpin(p);
+
+  // One region at a time, so the inodes to put fit in put[].
+  for(;;){
+    vmalock(p);
+    if((v = vmaoverlap(p, addr, end)) == 0){
+      vmaunlock(p);
+      return 0;
+    }
+    i = v - p->vma;
+    lo = max(addr, v->start);
+    hi = min(end, v->end);
+    j = i;
+    if(lo > v->start && hi < v->end){
+      for(j = 0; j < NVMA && p->vma[j].ip; j++)
+        ;
+      if(j == NVMA){
+        vmaunlock(p);
+        return -1;
+      }
+    }
+    n = 0;
+    for(q = proc; q < &proc[NPROC]; q++)
+      if(samevm(p, q) && (put[n] = vmacut(&q->vma[i], &q->vma[j], lo, hi)) != 0)
+        n++;
+    uvmunmap(p->pagetable, lo, (hi - lo) / PGSIZE, 1);
+    vmaunlock(p);
+
+    if(n > 0){
+      begin_op();
+      while(n > 0)
+        iput(put[--n]);
+      end_op();
+    }
+  }
+}
+
+// Copy the regions in from[] to to[], for fork() and clone().
+void
+vmadup(struct vma *to, struct vma *from)
+{
+  for(int i = 0; i < NVMA; i++){
+    to[i] = from[i];
+    if(to[i].ip)
+      idup(to[i].ip);
+  }
+}
+
+// Release the regions in v[], writing back the dirty pages of
+// shared ones as mapped by pagetable (if not 0). Their pages
+// are unmapped separately, with the rest of user memory.
+void
+vmaclose(pagetable_t pagetable, struct vma *v)
+{
+  int i;
+
+  if(pagetable)
+    for(i = 0; i < NVMA; i++)
+      if(v[i].ip && (v[i].flags & MAP_SHARED))
+        writeback(pagetable, &v[i], v[i].start, v[i].end);
+
+  begin_op();
+  for(i = 0; i < NVMA; i++){
+    if(v[i].ip){
+      iput(v[i].ip);
+      v[i].ip = 0;
+    }
+  }
+  end_op();
+}
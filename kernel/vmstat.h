@@ -0,0 +1,20 @@
+// Virtual memory event counters, as returned by vmstat().
+// Apart from freepages and freeblocks, they only ever grow;
+// diff two snapshots to measure a run.
+// Needs param.h.
+
+struct vmstat {
+  uint64 cowshare;   // pages fork() shared instead of copying
+  uint64 cowcopy;    // copy-on-write faults that copied the page
+  uint64 cowreuse;   // copy-on-write faults on pages nobody else mapped
+  uint64 lazyfill;   // heap pages allocated on first touch
+  uint64 filefill;   // program pages filled in from the file on first touch
+  uint64 filecached; // ... that were already in the page cache
+  uint64 superfill;  // heap superpages allocated on first touch
+  uint64 demote;     // superpages split into pages
+  uint64 faults;     // page faults on user memory
+  uint64 swapout;    // pages written out to swap
+  uint64 swapin;     // pages read back in from swap
+  uint64 freepages;  // free physical pages at the time of the call
+  uint64 freeblocks[MAXORDER+1]; // free blocks of 2^i pages, likewise
+};
@@ -18,7 +18,8 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks |
+//                                                                swap area ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
@@ -76,8 +77,17 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // -l n makes a log of n blocks, header included.
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || nlog <= 0 || nlog - (int)LOGHEADS(nlog) < MAXOPBLOCKS ||
+     nlog > LOGSIZE){
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
+    fprintf(stderr, "  nlog: log blocks, %d to %d\n",
+            MAXOPBLOCKS + 1, LOGSIZE);
     exit(1);
   }
 
@@ -102,6 +112,8 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(NSWAP);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -111,6 +123,11 @@ main(int argc, char *argv[])
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
 
+  // The swap area after the file system needs no contents;
+  // writing its last block makes the image big enough, and
+  // leaves the rest a hole in the image file.
+  wsect(FSSIZE + NSWAP*SWAPBLOCKS - 1, zeroes);
+
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
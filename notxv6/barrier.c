@@ -1,11 +1,46 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#define NROUND   20000
+#define MAXTHREAD 64
+#define MAXLOG    6     // log2(MAXTHREAD), dissemination rounds
+#define FANIN     4     // combining tree fan-in
+#define SPINS     1000  // spin this long before yielding the CPU
 
 static int nthread = 1;
-static int round = 0;
+static int nround = NROUND;
+static int bench = 0;   // no usleep, no checking
+
+// Keep per-thread spin variables on their own cache lines.
+struct padded {
+  volatile int v;
+} __attribute__((aligned(64)));
+
+// Spin until *p == want, yielding if that takes a while
+// so oversubscribed runs still make progress.
+static void
+spinwait(volatile int *p, int want)
+{
+  int n = 0;
+
+  while(__atomic_load_n(p, __ATOMIC_ACQUIRE) != want){
+    if(++n >= SPINS){
+      sched_yield();
+      n = 0;
+    }
+  }
+}
+
+//
+// Mutex + condition variable barrier: every round wakes every
+// waiter through one lock.
+//
 
 struct barrier {
   pthread_mutex_t barrier_mutex;
@@ -15,80 +50,291 @@ struct barrier {
 } bstate;
 
 static void
-barrier_init(void)
+cond_init(void)
 {
   assert(pthread_mutex_init(&bstate.barrier_mutex, NULL) == 0);
   assert(pthread_cond_init(&bstate.barrier_cond, NULL) == 0);
   bstate.nthread = 0;
+  bstate.round = 0;
 }
 
-static void 
-barrier()
+static void
+cond_wait(int id)
 {
-  // YOUR CODE HERE
-  //
-  // Block until all threads have called barrier() and
-  // then increment bstate.round.
-  //
-  
   pthread_mutex_lock(&bstate.barrier_mutex);
+  int round = bstate.round;
   bstate.nthread++;
-  //如果当前的线程都达到了屏障点，进行所有线程的唤醒,屏障次数++
-  if(bstate.nthread==nthread)
-  {
+  if(bstate.nthread == nthread){
+    // Last one in: start the next round and wake everyone.
     bstate.round++;
-    bstate.nthread=0;
+    bstate.nthread = 0;
     pthread_cond_broadcast(&bstate.barrier_cond);
+  } else {
+    // Loop, since condition variables can wake spuriously.
+    while(bstate.round == round)
+      pthread_cond_wait(&bstate.barrier_cond, &bstate.barrier_mutex);
+  }
+  pthread_mutex_unlock(&bstate.barrier_mutex);
+}
+
+//
+// Sense-reversing centralized barrier: threads count down one
+// shared counter, and the last one flips a shared sense flag
+// that everyone else spins on.
+//
+
+static struct {
+  volatile int count __attribute__((aligned(64)));
+  volatile int sense __attribute__((aligned(64)));
+} central;
+static struct padded localsense[MAXTHREAD];
+
+static void
+sense_init(void)
+{
+  central.count = nthread;
+  central.sense = 0;
+  for(int i = 0; i < nthread; i++)
+    localsense[i].v = 0;
+}
+
+static void
+sense_wait(int id)
+{
+  int s = localsense[id].v = !localsense[id].v;
+
+  if(__atomic_sub_fetch(&central.count, 1, __ATOMIC_ACQ_REL) == 0){
+    central.count = nthread;
+    __atomic_store_n(&central.sense, s, __ATOMIC_RELEASE);
+  } else {
+    spinwait(&central.sense, s);
   }
-  //否则等待
-  else
-  {
-    pthread_cond_wait(&bstate.barrier_cond,&bstate.barrier_mutex);
+}
+
+//
+// Combining-tree barrier: threads arrive at leaves of a tree
+// with fan-in FANIN; the last arrival at each node carries on
+// to its parent. The last arrival at the root releases the
+// tree top-down, each node flipping its own sense flag.
+//
+
+struct tnode {
+  volatile int count;
+  volatile int sense;
+  int k;                 // arrivals expected per round
+  struct tnode *parent;
+} __attribute__((aligned(64)));
+
+static struct tnode tnodes[2*MAXTHREAD];
+
+static void
+tree_init(void)
+{
+  int lo = 0, n = nthread, width, i;
+
+  // Level 0 has one node per FANIN threads; each higher
+  // level has one node per FANIN nodes below, up to a root.
+  for(;;){
+    width = (n + FANIN - 1) / FANIN;
+    for(i = 0; i < width; i++){
+      struct tnode *nd = &tnodes[lo + i];
+      nd->k = (i == width - 1) ? n - i*FANIN : FANIN;
+      nd->count = nd->k;
+      nd->sense = 0;
+      nd->parent = 0;
+    }
+    if(lo > 0){
+      for(i = 0; i < n; i++)
+        tnodes[lo - n + i].parent = &tnodes[lo + i / FANIN];
+    }
+    if(width == 1)
+      break;
+    lo += width;
+    n = width;
   }
+}
 
-  pthread_mutex_unlock(&bstate.barrier_mutex);
+static void
+tree_arrive(struct tnode *nd, int s)
+{
+  if(__atomic_sub_fetch(&nd->count, 1, __ATOMIC_ACQ_REL) == 0){
+    if(nd->parent)
+      tree_arrive(nd->parent, s);
+    nd->count = nd->k;
+    __atomic_store_n(&nd->sense, s, __ATOMIC_RELEASE);
+  } else {
+    spinwait(&nd->sense, s);
+  }
+}
+
+static void
+tree_wait(int id)
+{
+  int s = localsense[id].v = !localsense[id].v;
+
+  tree_arrive(&tnodes[id / FANIN], s);
 }
 
+//
+// Dissemination barrier: in round r, thread i signals thread
+// (i + 2^r) mod n and waits for thread (i - 2^r) mod n, so after
+// ceil(log2 n) rounds each thread has heard from every other.
+// Flags alternate between two sets (parity) so a fast thread's
+// next episode cannot clobber a slow thread's current one.
+//
+
+static struct {
+  struct padded flag[2][MAXLOG];
+  int parity;
+  int sense;
+} dis[MAXTHREAD];
+static int nlog;
+
+static void
+dissem_init(void)
+{
+  memset(dis, 0, sizeof(dis));
+  for(int i = 0; i < nthread; i++)
+    dis[i].sense = 1;
+  for(nlog = 0; (1 << nlog) < nthread; nlog++)
+    ;
+}
+
+static void
+dissem_wait(int id)
+{
+  int p = dis[id].parity, s = dis[id].sense;
+
+  for(int r = 0; r < nlog; r++){
+    int partner = (id + (1 << r)) % nthread;
+    __atomic_store_n(&dis[partner].flag[p][r].v, s, __ATOMIC_RELEASE);
+    spinwait(&dis[id].flag[p][r].v, s);
+  }
+  if(p == 1)
+    dis[id].sense = !s;
+  dis[id].parity = 1 - p;
+}
+
+static struct algo {
+  char *name;
+  void (*init)(void);
+  void (*wait)(int id);
+} algos[] = {
+  { "cond",   cond_init,   cond_wait },
+  { "sense",  sense_init,  sense_wait },
+  { "tree",   tree_init,   tree_wait },
+  { "dissem", dissem_init, dissem_wait },
+};
+#define NALGO ((int)(sizeof(algos)/sizeof(algos[0])))
+
+static struct algo *algo = &algos[0];
+
+// progress[i] is the number of barriers thread i has entered.
+static struct padded progress[MAXTHREAD];
+
 static void *
 thread(void *xa)
 {
   long n = (long) xa;
-  long delay;
   int i;
 
-  for (i = 0; i < 20000; i++) {
-    int t = bstate.round;
-    assert (i == t);
-    barrier();
+  for (i = 0; i < nround; i++) {
+    if(bench){
+      algo->wait(n);
+      continue;
+    }
+    progress[n].v = i + 1;
+    algo->wait(n);
+    // Everyone must have entered barrier i, and nobody can
+    // have got past barrier i+1 without us.
+    for(int j = 0; j < nthread; j++){
+      int pj = __atomic_load_n(&progress[j].v, __ATOMIC_ACQUIRE);
+      assert(pj == i + 1 || pj == i + 2);
+    }
     usleep(random() % 100);
   }
 
   return 0;
 }
 
-int
-main(int argc, char *argv[])
+static double
+now(void)
 {
-  pthread_t *tha;
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Run nround barriers on nthread threads with the current
+// algorithm, returning elapsed seconds.
+static double
+run(void)
+{
+  pthread_t tha[MAXTHREAD];
   void *value;
   long i;
-  double t1, t0;
-
-  if (argc < 2) {
-    fprintf(stderr, "%s: %s nthread\n", argv[0], argv[0]);
-    exit(-1);
-  }
-  nthread = atoi(argv[1]);
-  tha = malloc(sizeof(pthread_t) * nthread);
-  srandom(0);
-
-  barrier_init();
+  double t0;
 
+  memset(progress, 0, sizeof(progress));
+  algo->init();
+  t0 = now();
   for(i = 0; i < nthread; i++) {
     assert(pthread_create(&tha[i], NULL, thread, (void *) i) == 0);
   }
   for(i = 0; i < nthread; i++) {
     assert(pthread_join(tha[i], &value) == 0);
   }
+  return now() - t0;
+}
+
+static void
+usage(char *prog)
+{
+  fprintf(stderr, "%s: %s [-a cond|sense|tree|dissem] nthread\n", prog, prog);
+  fprintf(stderr, "%s: %s -b maxthread [nround]\n", prog, prog);
+  exit(-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if (argc >= 3 && strcmp(argv[1], "-a") == 0) {
+    for(i = 0; i < NALGO; i++)
+      if(strcmp(argv[2], algos[i].name) == 0)
+        algo = &algos[i];
+    if(strcmp(argv[2], algo->name) != 0)
+      usage(argv[0]);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc < 2)
+    usage(argv[0]);
+  srandom(0);
+
+  if (strcmp(argv[1], "-b") == 0) {
+    // Benchmark: rounds/sec for each algorithm and thread count.
+    if (argc < 3)
+      usage(argv[0]);
+    int maxthread = atoi(argv[2]);
+    if (argc > 3)
+      nround = atoi(argv[3]);
+    if (maxthread < 1 || maxthread > MAXTHREAD || nround < 1)
+      usage(argv[0]);
+    bench = 1;
+    printf("%8s %8s %12s\n", "algo", "threads", "rounds/s");
+    for(i = 0; i < NALGO; i++){
+      algo = &algos[i];
+      for(nthread = 1; nthread <= maxthread; nthread++)
+        printf("%8s %8d %12.0f\n", algo->name, nthread, nround / run());
+    }
+    exit(0);
+  }
+
+  nthread = atoi(argv[1]);
+  if (nthread < 1 || nthread > MAXTHREAD)
+    usage(argv[0]);
+  run();
   printf("OK; passed\n");
 }
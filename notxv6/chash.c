@@ -0,0 +1,456 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "chash.h"
+
+#define POOLCHUNK     4096  // entries per pool chunk
+#define RECLAIM_EVERY 64    // retirements between reclaim attempts
+
+struct entry {
+  int key;
+  int value;                // updated in place with atomic stores
+  struct entry *next;       // bucket chain; left intact after unlink
+  struct entry *rnext;      // retire list or pool free list
+  unsigned long repoch;     // global epoch when retired
+};
+
+struct table {
+  unsigned long n;          // number of buckets
+  struct entry **bucket;
+  struct table *rnext;      // retire list
+  unsigned long repoch;
+};
+
+struct stripe {
+  pthread_mutex_t lock;
+  long count;               // entries in this stripe's buckets
+} __attribute__((aligned(64)));
+
+struct chash_thread {
+  struct chash *h;
+  unsigned long epoch;      // global epoch seen by the current reader
+  int active;               // inside chash_get()?
+  struct entry *free;       // entry pool
+  struct entry *limbo;      // retired entries, newest first
+  struct table *tlimbo;     // retired tables, newest first
+  int nretired;
+} __attribute__((aligned(64)));
+
+struct chunk {
+  struct chunk *next;
+  struct entry e[POOLCHUNK];
+};
+
+struct chash {
+  struct table *table;      // current table, swapped by resize()
+  int resize;
+  unsigned long epoch;      // global epoch
+  struct stripe stripe[CHASH_NSTRIPE];
+
+  pthread_mutex_t joinlock; // protects nthread and chunks
+  int nthread;
+  struct chunk *chunks;
+  struct chash_thread thread[CHASH_MAXTHREAD];
+};
+
+static unsigned long
+hash(int key)
+{
+  unsigned long x = (unsigned int) key;
+
+  x *= 0x9E3779B97F4A7C15UL;
+  return x ^ (x >> 29);
+}
+
+static struct table*
+table_alloc(unsigned long nbucket)
+{
+  struct table *tb = malloc(sizeof(*tb));
+
+  if(tb == 0)
+    return 0;
+  tb->bucket = calloc(nbucket, sizeof(struct entry *));
+  if(tb->bucket == 0){
+    free(tb);
+    return 0;
+  }
+  tb->n = nbucket;
+  tb->rnext = 0;
+  return tb;
+}
+
+//
+// Epoch-based reclamation.
+//
+// A reader publishes the global epoch it saw on entry. The
+// global epoch only advances when every active reader has
+// seen the current one, so once it has moved twice past the
+// epoch at which something was retired, no reader can still
+// hold a pointer to it.
+//
+
+static void
+read_enter(struct chash_thread *t)
+{
+  __atomic_store_n(&t->active, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&t->epoch, __atomic_load_n(&t->h->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
+
+static void
+read_exit(struct chash_thread *t)
+{
+  __atomic_store_n(&t->active, 0, __ATOMIC_RELEASE);
+}
+
+static void
+try_advance(struct chash *h)
+{
+  unsigned long e = __atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST);
+  int n = __atomic_load_n(&h->nthread, __ATOMIC_ACQUIRE);
+
+  for(int i = 0; i < n; i++){
+    struct chash_thread *t = &h->thread[i];
+    if(__atomic_load_n(&t->active, __ATOMIC_SEQ_CST) &&
+       __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST) != e)
+      return;
+  }
+  __atomic_compare_exchange_n(&h->epoch, &e, e + 1, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Move retired entries and tables that no reader can see
+// any more into t's entry pool.
+static void
+reclaim(struct chash_thread *t)
+{
+  struct entry **ep, *e, *enext;
+  struct table **tp, *tb, *tnext;
+  unsigned long g;
+
+  try_advance(t->h);
+  g = __atomic_load_n(&t->h->epoch, __ATOMIC_SEQ_CST);
+
+  // The limbo lists are sorted newest first, so everything
+  // after the first old-enough node is old enough too.
+  for(ep = &t->limbo; *ep && (*ep)->repoch + 2 > g; ep = &(*ep)->rnext)
+    ;
+  for(e = *ep; e; e = enext){
+    enext = e->rnext;
+    e->rnext = t->free;
+    t->free = e;
+  }
+  *ep = 0;
+
+  for(tp = &t->tlimbo; *tp && (*tp)->repoch + 2 > g; tp = &(*tp)->rnext)
+    ;
+  for(tb = *tp; tb; tb = tnext){
+    tnext = tb->rnext;
+    for(unsigned long i = 0; i < tb->n; i++){
+      for(e = tb->bucket[i]; e; e = enext){
+        enext = e->next;
+        e->rnext = t->free;
+        t->free = e;
+      }
+    }
+    free(tb->bucket);
+    free(tb);
+  }
+  *tp = 0;
+}
+
+static void
+retire_entry(struct chash_thread *t, struct entry *e)
+{
+  e->repoch = __atomic_load_n(&t->h->epoch, __ATOMIC_SEQ_CST);
+  e->rnext = t->limbo;
+  t->limbo = e;
+  if(++t->nretired % RECLAIM_EVERY == 0)
+    reclaim(t);
+}
+
+static void
+retire_table(struct chash_thread *t, struct table *tb)
+{
+  tb->repoch = __atomic_load_n(&t->h->epoch, __ATOMIC_SEQ_CST);
+  tb->rnext = t->tlimbo;
+  t->tlimbo = tb;
+  reclaim(t);
+}
+
+//
+// Entry pool.
+//
+
+static struct entry*
+entry_alloc(struct chash_thread *t)
+{
+  struct entry *e;
+
+  if(t->free == 0 && t->limbo)
+    reclaim(t);
+  if(t->free == 0){
+    struct chunk *c = malloc(sizeof(*c));
+    if(c == 0)
+      return 0;
+    for(int i = 0; i < POOLCHUNK; i++){
+      c->e[i].rnext = t->free;
+      t->free = &c->e[i];
+    }
+    pthread_mutex_lock(&t->h->joinlock);
+    c->next = t->h->chunks;
+    t->h->chunks = c;
+    pthread_mutex_unlock(&t->h->joinlock);
+  }
+  e = t->free;
+  t->free = e->rnext;
+  return e;
+}
+
+//
+// Map operations.
+//
+
+struct chash*
+chash_create(int nbucket, int resize)
+{
+  struct chash *h;
+  unsigned long n = nbucket > 0 ? nbucket : 1;
+
+  if(posix_memalign((void **) &h, 64, sizeof(*h)) != 0)
+    return 0;
+  memset(h, 0, sizeof(*h));
+  if((h->table = table_alloc(n)) == 0){
+    free(h);
+    return 0;
+  }
+  h->resize = resize;
+  pthread_mutex_init(&h->joinlock, 0);
+  for(int i = 0; i < CHASH_NSTRIPE; i++)
+    pthread_mutex_init(&h->stripe[i].lock, 0);
+  return h;
+}
+
+void
+chash_destroy(struct chash *h)
+{
+  struct chunk *c, *cnext;
+  struct table *tb, *tnext;
+
+  for(int i = 0; i < h->nthread; i++){
+    for(tb = h->thread[i].tlimbo; tb; tb = tnext){
+      tnext = tb->rnext;
+      free(tb->bucket);
+      free(tb);
+    }
+  }
+  free(h->table->bucket);
+  free(h->table);
+  for(c = h->chunks; c; c = cnext){
+    cnext = c->next;
+    free(c);
+  }
+  for(int i = 0; i < CHASH_NSTRIPE; i++)
+    pthread_mutex_destroy(&h->stripe[i].lock);
+  pthread_mutex_destroy(&h->joinlock);
+  free(h);
+}
+
+struct chash_thread*
+chash_join(struct chash *h)
+{
+  struct chash_thread *t = 0;
+
+  pthread_mutex_lock(&h->joinlock);
+  if(h->nthread < CHASH_MAXTHREAD){
+    t = &h->thread[h->nthread];
+    t->h = h;
+    __atomic_store_n(&h->nthread, h->nthread + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&h->joinlock);
+  return t;
+}
+
+int
+chash_nbucket(struct chash *h)
+{
+  return __atomic_load_n(&h->table, __ATOMIC_ACQUIRE)->n;
+}
+
+// Bucket b belongs to stripe b % CHASH_NSTRIPE. How many
+// buckets of tb does stripe si own?
+static unsigned long
+stripe_buckets(struct table *tb, int si)
+{
+  return (tb->n + CHASH_NSTRIPE - 1 - si) / CHASH_NSTRIPE;
+}
+
+// Lock the stripe that owns key hash hv's bucket, and return
+// it with the current table in *tbp. Which stripe that is
+// depends on the table's size, so look under the lock again
+// in case a resize got in first. resize() holds every stripe
+// lock while it swaps h->table, so under the lock the table
+// is stable.
+static struct stripe*
+stripe_lock(struct chash_thread *t, unsigned long hv, struct table **tbp)
+{
+  struct chash *h = t->h;
+  struct table *tb;
+  struct stripe *s, *right;
+
+  // The table may be retired under us until we hold a lock.
+  read_enter(t);
+  tb = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+  s = &h->stripe[(hv % tb->n) % CHASH_NSTRIPE];
+  read_exit(t);
+  for(;;){
+    pthread_mutex_lock(&s->lock);
+    tb = h->table;
+    right = &h->stripe[(hv % tb->n) % CHASH_NSTRIPE];
+    if(s == right){
+      *tbp = tb;
+      return s;
+    }
+    pthread_mutex_unlock(&s->lock);
+    s = right;
+  }
+}
+
+// Double the table. Takes every stripe lock, so no writer
+// is active, copies the entries into a new table, and
+// publishes it. Readers still walking old keep working.
+static void
+resize(struct chash_thread *t, struct table *old)
+{
+  struct chash *h = t->h;
+  struct table *tb;
+  struct entry *e, *n, **b;
+  int i;
+
+  for(i = 0; i < CHASH_NSTRIPE; i++)
+    pthread_mutex_lock(&h->stripe[i].lock);
+
+  // Someone else may have resized first.
+  if(h->table != old || (tb = table_alloc(2 * old->n)) == 0)
+    goto out;
+
+  for(unsigned long j = 0; j < old->n; j++){
+    for(e = old->bucket[j]; e; e = e->next){
+      if((n = entry_alloc(t)) == 0)
+        goto nomem;
+      n->key = e->key;
+      n->value = e->value;
+      b = &tb->bucket[hash(e->key) % tb->n];
+      n->next = *b;
+      *b = n;
+    }
+  }
+  // The buckets moved between stripes; count them again.
+  for(i = 0; i < CHASH_NSTRIPE; i++)
+    h->stripe[i].count = 0;
+  for(unsigned long j = 0; j < tb->n; j++)
+    for(e = tb->bucket[j]; e; e = e->next)
+      h->stripe[j % CHASH_NSTRIPE].count++;
+  __atomic_store_n(&h->table, tb, __ATOMIC_RELEASE);
+  for(i = 0; i < CHASH_NSTRIPE; i++)
+    pthread_mutex_unlock(&h->stripe[i].lock);
+  retire_table(t, old);
+  return;
+
+nomem:
+  // Nobody has seen tb; give back its copies and keep old.
+  for(unsigned long j = 0; j < tb->n; j++){
+    for(e = tb->bucket[j]; e; e = n){
+      n = e->next;
+      e->rnext = t->free;
+      t->free = e;
+    }
+  }
+  free(tb->bucket);
+  free(tb);
+out:
+  for(i = 0; i < CHASH_NSTRIPE; i++)
+    pthread_mutex_unlock(&h->stripe[i].lock);
+}
+
+int
+chash_put(struct chash_thread *t, int key, int value)
+{
+  struct chash *h = t->h;
+  unsigned long hv = hash(key);
+  struct stripe *s;
+  struct table *tb;
+  struct entry *e, **b;
+  int grow;
+
+  s = stripe_lock(t, hv, &tb);
+  b = &tb->bucket[hv % tb->n];
+  for(e = *b; e; e = e->next){
+    if(e->key == key){
+      __atomic_store_n(&e->value, value, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&s->lock);
+      return 0;
+    }
+  }
+  if((e = entry_alloc(t)) == 0){
+    pthread_mutex_unlock(&s->lock);
+    return -1;
+  }
+  e->key = key;
+  e->value = value;
+  e->next = *b;
+  __atomic_store_n(b, e, __ATOMIC_RELEASE);  // publish to readers
+  s->count++;
+  grow = h->resize &&
+    s->count > (long) stripe_buckets(tb, s - h->stripe) * CHASH_LOAD;
+  pthread_mutex_unlock(&s->lock);
+
+  if(grow)
+    resize(t, tb);
+  return 1;
+}
+
+int
+chash_get(struct chash_thread *t, int key, int *value)
+{
+  struct table *tb;
+  struct entry *e;
+  unsigned long hv = hash(key);
+  int found = 0;
+
+  read_enter(t);
+  tb = __atomic_load_n(&t->h->table, __ATOMIC_ACQUIRE);
+  e = __atomic_load_n(&tb->bucket[hv % tb->n], __ATOMIC_ACQUIRE);
+  for(; e; e = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE)){
+    if(e->key == key){
+      *value = __atomic_load_n(&e->value, __ATOMIC_RELAXED);
+      found = 1;
+      break;
+    }
+  }
+  read_exit(t);
+  return found;
+}
+
+int
+chash_del(struct chash_thread *t, int key)
+{
+  unsigned long hv = hash(key);
+  struct stripe *s;
+  struct table *tb;
+  struct entry *e, **pp;
+
+  s = stripe_lock(t, hv, &tb);
+  for(pp = &tb->bucket[hv % tb->n]; (e = *pp) != 0; pp = &e->next){
+    if(e->key == key){
+      // e->next stays intact for readers standing on e.
+      __atomic_store_n(pp, e->next, __ATOMIC_RELEASE);
+      s->count--;
+      pthread_mutex_unlock(&s->lock);
+      retire_entry(t, e);
+      return 1;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
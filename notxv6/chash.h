@@ -0,0 +1,50 @@
+// Concurrent hash map from int keys to int values.
+//
+// Writers (put/del) lock one of CHASH_NSTRIPE lock stripes,
+// the one that owns the key's bucket, so writers of different
+// keys rarely contend unless the table has few buckets.
+// Readers (get) take no locks at all: they run inside an
+// epoch-based read-side critical section, and anything a
+// writer unlinks is only recycled once every reader that
+// might still see it has left.
+//
+// The table doubles when a stripe's share of entries passes
+// CHASH_LOAD per bucket. Resizing copies the entries into a
+// new bucket array and publishes it with one pointer store,
+// so readers of the old array are never disturbed.
+//
+// Entries come from per-thread pools carved out of large
+// chunks instead of one malloc() per insert.
+//
+// Every thread that uses a map calls chash_join() once and
+// passes the returned handle to each operation.
+
+#define CHASH_NSTRIPE  64   // writer lock stripes; power of two
+#define CHASH_LOAD     4    // average chain length that triggers a resize
+#define CHASH_MAXTHREAD 128 // max threads joined to one map
+
+struct chash;
+struct chash_thread;
+
+// Create a map with nbucket buckets. If resize is 0 the table
+// keeps its initial size. Returns 0 on failure.
+struct chash *chash_create(int nbucket, int resize);
+
+// Free the map and all its entries. No thread may be using it.
+void chash_destroy(struct chash *h);
+
+// Register the calling thread with h. Returns 0 if too many
+// threads have joined.
+struct chash_thread *chash_join(struct chash *h);
+
+// Insert key or update its value. Returns 1 if key was new.
+int chash_put(struct chash_thread *t, int key, int value);
+
+// Look key up. Returns 1 and sets *value if found, else 0.
+int chash_get(struct chash_thread *t, int key, int *value);
+
+// Remove key. Returns 1 if it was present.
+int chash_del(struct chash_thread *t, int key);
+
+// Current number of buckets, for reporting.
+int chash_nbucket(struct chash *h);
@@ -1,24 +1,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include "chash.h"
 
 #define NBUCKET 5
 #define NKEYS 100000
 
-//定义锁，对应哈希表中每一个bucket一个锁
-pthread_mutex_t lock[NBUCKET];
-
-struct entry {
-  int key;
-  int value;
-  struct entry *next;
-};
-struct entry *table[NBUCKET];
+struct chash *table;
 int keys[NKEYS];
 int nthread = 1;
+int verbose = 1;   // print per-thread missing-key counts
 
 double
 now()
@@ -28,63 +23,17 @@ now()
  return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
-static void 
-insert(int key, int value, struct entry **p, struct entry *n)
-{
-  struct entry *e = malloc(sizeof(struct entry));
-  e->key = key;
-  e->value = value;
-  e->next = n;
-  *p = e;
-}
-
-
-static 
-void put(int key, int value)
-{
-  int i = key % NBUCKET;
-
-  // is the key already present?
-  struct entry *e = 0;
-  //获取锁
-  pthread_mutex_lock(&lock[i]);
-  for (e = table[i]; e != 0; e = e->next) {
-    if (e->key == key)
-      break;
-  }
-  if(e){
-    // update the existing key.
-    e->value = value;
-  } else {
-    // the new is new.
-    insert(key, value, &table[i], table[i]);
-  }
-  //释放锁
-  pthread_mutex_unlock(&lock[i]);
-}
-
-static struct entry*
-get(int key)
-{
-  int i = key % NBUCKET;
-
-
-  struct entry *e = 0;
-  for (e = table[i]; e != 0; e = e->next) {
-    if (e->key == key) break;
-  }
-
-  return e;
-}
-
 static void *
 put_thread(void *xa)
 {
   int n = (int) (long) xa; // thread number
-  int b = NKEYS/nthread;
+  struct chash_thread *t = chash_join(table);
+  int lo = (long) NKEYS * n / nthread;
+  int hi = (long) NKEYS * (n + 1) / nthread;
 
-  for (int i = 0; i < b; i++) {
-    put(keys[b*n + i], n);
+  assert(t != 0);
+  for (int i = lo; i < hi; i++) {
+    assert(chash_put(t, keys[i], n) >= 0);
   }
 
   return NULL;
@@ -94,40 +43,35 @@ static void *
 get_thread(void *xa)
 {
   int n = (int) (long) xa; // thread number
+  struct chash_thread *t = chash_join(table);
   int missing = 0;
+  int value;
 
+  assert(t != 0);
   for (int i = 0; i < NKEYS; i++) {
-    struct entry *e = get(keys[i]);
-    if (e == 0) missing++;
+    if (!chash_get(t, keys[i], &value)) missing++;
   }
-  printf("%d: %d keys missing\n", n, missing);
+  if (verbose)
+    printf("%d: %d keys missing\n", n, missing);
+  else
+    assert(missing == 0);
   return NULL;
 }
 
-int
-main(int argc, char *argv[])
+// Run one round of puts then gets with the current nthread
+// against a fresh table. Returns the table's final bucket
+// count and stores the rates in *puts and *gets.
+static int
+run(int nbucket, int resize, double *puts, double *gets)
 {
+  int final;
   pthread_t *tha;
   void *value;
   double t1, t0;
 
-  //初始化哈希表中所有bucket的锁
-  for(int i=0;i<NBUCKET;i++)
-  {
-    pthread_mutex_init(&lock[i],NULL);
-  }
-
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s nthreads\n", argv[0]);
-    exit(-1);
-  }
-  nthread = atoi(argv[1]);
   tha = malloc(sizeof(pthread_t) * nthread);
-  srandom(0);
-  assert(NKEYS % nthread == 0);
-  for (int i = 0; i < NKEYS; i++) {
-    keys[i] = random();
-  }
+  table = chash_create(nbucket, resize);
+  assert(table != 0);
 
   //
   // first the puts
@@ -140,9 +84,11 @@ main(int argc, char *argv[])
     assert(pthread_join(tha[i], &value) == 0);
   }
   t1 = now();
+  *puts = NKEYS / (t1 - t0);
 
-  printf("%d puts, %.3f seconds, %.0f puts/second\n",
-         NKEYS, t1 - t0, NKEYS / (t1 - t0));
+  if (verbose)
+    printf("%d puts, %.3f seconds, %.0f puts/second\n",
+           NKEYS, t1 - t0, *puts);
 
   //
   // now the gets
@@ -155,7 +101,65 @@ main(int argc, char *argv[])
     assert(pthread_join(tha[i], &value) == 0);
   }
   t1 = now();
+  *gets = (NKEYS*nthread) / (t1 - t0);
+
+  if (verbose)
+    printf("%d gets, %.3f seconds, %.0f gets/second\n",
+           NKEYS*nthread, t1 - t0, *gets);
+
+  final = chash_nbucket(table);
+  chash_destroy(table);
+  free(tha);
+  return final;
+}
+
+// Benchmark mode: puts/sec and gets/sec for 1..maxthread
+// threads and a range of initial bucket counts.
+static void
+bench(int maxthread, int resize)
+{
+  static int nbuckets[] = { NBUCKET, 1024, 16384, 131072 };
+  double puts, gets;
+
+  verbose = 0;
+  printf("%8s %8s %8s %12s %12s\n", "buckets", "final", "threads", "puts/s", "gets/s");
+  for (int b = 0; b < sizeof(nbuckets)/sizeof(nbuckets[0]); b++) {
+    for (nthread = 1; nthread <= maxthread; nthread++) {
+      int final = run(nbuckets[b], resize, &puts, &gets);
+      printf("%8d %8d %8d %12.0f %12.0f\n", nbuckets[b], final, nthread, puts, gets);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  double puts, gets;
+  int resize = 1;
 
-  printf("%d gets, %.3f seconds, %.0f gets/second\n",
-         NKEYS*nthread, t1 - t0, (NKEYS*nthread) / (t1 - t0));
+  if (argc >= 2 && strcmp(argv[1], "-f") == 0) {
+    resize = 0;
+    argv++;
+    argc--;
+  }
+  if (argc < 2 || (strcmp(argv[1], "-b") == 0 && argc < 3)) {
+    fprintf(stderr, "Usage: %s [-f] nthreads\n", argv[0]);
+    fprintf(stderr, "       %s [-f] -b maxthreads\n", argv[0]);
+    fprintf(stderr, "  -f: fixed-size table, no resizing\n");
+    exit(-1);
+  }
+
+  srandom(0);
+  for (int i = 0; i < NKEYS; i++) {
+    keys[i] = random();
+  }
+
+  if (strcmp(argv[1], "-b") == 0) {
+    bench(atoi(argv[2]), resize);
+    exit(0);
+  }
+
+  nthread = atoi(argv[1]);
+  assert(nthread > 0);
+  run(NBUCKET, resize, &puts, &gets);
 }
@@ -0,0 +1,79 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/kthread.h"
+
+//
+// Barrier test and benchmark: notxv6/barrier.c on kernel
+// threads and a futex-based barrier.
+// barrier nthread [nround]
+// Threads do a little uneven work between rounds, and check
+// after each round that every thread has reached it.
+//
+
+#define MAXTHREAD 15    // NTHREAD less the main thread
+
+struct kbarrier bar;
+int nthread, nround = 2000;
+volatile int progress[MAXTHREAD];   // barriers entered by each thread
+
+void
+thread(void *xa)
+{
+  int n = (int)(uint64)xa;
+  volatile int spin;
+
+  for(int i = 0; i < nround; i++){
+    progress[n] = i + 1;
+    kbarrier_wait(&bar);
+    // Everyone must have entered barrier i, and nobody can
+    // have got past barrier i+1 without us.
+    for(int j = 0; j < nthread; j++){
+      int pj = progress[j];
+      if(pj != i + 1 && pj != i + 2){
+        printf("barrier: thread %d saw thread %d at %d in round %d\n",
+               n, j, pj, i);
+        exit(1);
+      }
+    }
+    for(spin = 0; spin < (i * 7 + n * 13) % 500; spin++)
+      ;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tids[MAXTHREAD];
+  int i, t0, t;
+
+  if(argc < 2 || (nthread = atoi(argv[1])) < 1 || nthread > MAXTHREAD){
+    fprintf(2, "usage: barrier nthread [nround]\n");
+    exit(1);
+  }
+  if(argc > 2)
+    nround = atoi(argv[2]);
+
+  kbarrier_init(&bar, nthread);
+  t0 = uptime();
+  for(i = 0; i < nthread; i++){
+    if((tids[i] = kthread_create(thread, (void*)(uint64)i)) < 0){
+      fprintf(2, "barrier: kthread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthread; i++){
+    if(kthread_join(tids[i]) < 0){
+      fprintf(2, "barrier: kthread_join failed\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t0;
+
+  printf("OK; passed\n");
+  printf("%d rounds, %d threads, %d ticks", nround, nthread, t);
+  if(t > 0)
+    printf(", %d rounds/tick", nround / t);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,114 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+//
+// Exec benchmark.
+// execbench n command [args...]
+//   runs command n times, one after another, and reports the
+//   time taken and how program pages were filled in.
+// execbench -r n command [args...]
+//   starts n copies of command at once, lets them run for a
+//   few ticks, and reports the memory they hold between them.
+// The copies' output is closed; their input is a pipe nobody
+// writes, so a shell sits waiting for a command. Only the
+// copies themselves are killed, so command must not leave
+// children of its own running (grind does).
+//
+
+#define MAXCOPY 32
+#define RUNTICKS 10
+
+int fds[2];
+
+int
+start(char **argv)
+{
+  int pid = fork();
+
+  if(pid < 0){
+    fprintf(2, "execbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    close(1);
+    close(2);
+    exec(argv[0], argv);
+    exit(1);
+  }
+  return pid;
+}
+
+void
+latency(int n, char **argv)
+{
+  struct vmstat a, b;
+  int i, t0, t1;
+
+  vmstat(&a);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    start(argv);
+    wait(0);
+  }
+  t1 = uptime();
+  vmstat(&b);
+
+  printf("%s: %d runs, %d ticks, filled %d pages, %d from cache\n",
+         argv[0], n, t1 - t0, (int)(b.filefill - a.filefill),
+         (int)(b.filecached - a.filecached));
+}
+
+void
+resident(int n, char **argv)
+{
+  struct vmstat a, b;
+  int i, pid[MAXCOPY], used;
+
+  vmstat(&a);
+  for(i = 0; i < n; i++)
+    pid[i] = start(argv);
+  sleep(RUNTICKS);
+  vmstat(&b);
+  for(i = 0; i < n; i++){
+    kill(pid[i]);
+    wait(0);
+  }
+
+  used = (int)(a.freepages - b.freepages);
+  printf("%s: %d copies, %d pages resident, %d each, filled %d pages, %d from cache\n",
+         argv[0], n, used, used / n, (int)(b.filefill - a.filefill),
+         (int)(b.filecached - a.filecached));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rflag = 0, n;
+
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    rflag = 1;
+    argc--;
+    argv++;
+  }
+  if(argc < 3 || (n = atoi(argv[1])) < 1 || (rflag && n > MAXCOPY)){
+    fprintf(2, "usage: execbench [-r] n command [args...]\n");
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "execbench: pipe failed\n");
+    exit(1);
+  }
+
+  if(rflag)
+    resident(n, argv + 2);
+  else
+    latency(n, argv + 2);
+  exit(0);
+}
@@ -0,0 +1,74 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+//
+// Fork latency benchmark.
+// forkbench [npages [nfork]]
+// Touches npages of heap, then times nfork fork()s whose
+// children exit at once, as a child about to exec() would,
+// and nfork whose children first write every page.
+//
+
+#define PGSIZE 4096
+
+char *heap;
+int npages = 256;
+
+void
+run(char *what, int nfork, int touch)
+{
+  struct vmstat a, b;
+  int i, pid, t0, t1;
+
+  vmstat(&a);
+  t0 = uptime();
+  for(i = 0; i < nfork; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      if(touch)
+        for(int j = 0; j < npages; j++)
+          heap[j*PGSIZE] = j;
+      exit(0);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  vmstat(&b);
+
+  printf("%s: %d forks, %d ticks, pages shared %d copied %d reused %d\n",
+         what, nfork, t1 - t0, (int)(b.cowshare - a.cowshare),
+         (int)(b.cowcopy - a.cowcopy), (int)(b.cowreuse - a.cowreuse));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nfork = 100;
+
+  if(argc > 1)
+    npages = atoi(argv[1]);
+  if(argc > 2)
+    nfork = atoi(argv[2]);
+  if(npages < 1 || nfork < 1){
+    fprintf(2, "usage: forkbench [npages [nfork]]\n");
+    exit(1);
+  }
+
+  if((heap = sbrk(npages * PGSIZE)) == (char*)-1){
+    fprintf(2, "forkbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int j = 0; j < npages; j++)
+    heap[j*PGSIZE] = j;
+
+  run("fork+exit", nfork, 0);
+  run("fork+write", nfork, 1);
+  exit(0);
+}
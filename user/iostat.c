@@ -0,0 +1,60 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+//
+// iostat command [args...]
+// Run command and print the log commits, disk requests and
+// prefetches it caused, with the mean time a commit took.
+//
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat a, b;
+  int pid, t0, t1, commits, blocks, reqs;
+
+  if(argc < 2){
+    fprintf(2, "usage: iostat command [args...]\n");
+    exit(1);
+  }
+
+  if(iostat(&a) < 0){
+    fprintf(2, "iostat: iostat failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "iostat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "iostat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  t1 = uptime();
+  iostat(&b);
+
+  // Commit time is in timer cycles, 10 to the microsecond.
+  commits = b.commits - a.commits;
+  blocks = b.commitblocks - a.commitblocks;
+  reqs = b.diskreqs - a.diskreqs;
+  printf("ticks %d\n", t1 - t0);
+  printf("log: %d commits, %d blocks", commits, blocks);
+  if(commits > 0)
+    printf(", %d blocks and %d us per commit", blocks / commits,
+           (int)((b.committime - a.committime) / 10 / commits));
+  printf("\n");
+  printf("disk: %d requests, %d blocks", reqs, (int)(b.diskblocks - a.diskblocks));
+  if(reqs > 0)
+    printf(", %d blocks per request", (int)(b.diskblocks - a.diskblocks) / reqs);
+  printf("\n");
+  printf("prefetch: %d blocks; bread: %d found prefetched, %d read themselves\n",
+         (int)(b.prefetch - a.prefetch), (int)(b.rahit - a.rahit),
+         (int)(b.ramiss - a.ramiss));
+  exit(0);
+}
@@ -0,0 +1,151 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/futex.h"
+#include "user/user.h"
+#include "user/kthread.h"
+
+#define TSTACKSIZE (4*4096)
+
+// Threads created and not yet joined.
+static struct kthread {
+  int tid;
+  int done;              // reaped while joining another thread
+  void (*fn)(void*);
+  void *arg;
+  char *stack;           // 0 if the slot is free
+} threads[NTHREAD];
+static struct kmutex tlock;
+
+static void
+kthread_start(void *xt)
+{
+  struct kthread *t = xt;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Start fn(arg) in a new thread. Returns its tid, or -1.
+int
+kthread_create(void (*fn)(void*), void *arg)
+{
+  struct kthread *t;
+  int tid;
+
+  kmutex_lock(&tlock);
+  for(t = threads; t < &threads[NTHREAD]; t++)
+    if(t->stack == 0)
+      break;
+  if(t == &threads[NTHREAD] || (t->stack = malloc(TSTACKSIZE)) == 0){
+    kmutex_unlock(&tlock);
+    return -1;
+  }
+  t->fn = fn;
+  t->arg = arg;
+  t->done = 0;
+  t->tid = 0;
+  if((tid = clone(kthread_start, t, t->stack + TSTACKSIZE)) < 0){
+    free(t->stack);
+    t->stack = 0;
+    kmutex_unlock(&tlock);
+    return -1;
+  }
+  t->tid = tid;
+  kmutex_unlock(&tlock);
+  return tid;
+}
+
+// Wait for thread tid to exit. Returns -1 if there is no
+// such thread.
+int
+kthread_join(int tid)
+{
+  struct kthread *t;
+  int pid;
+
+  for(;;){
+    kmutex_lock(&tlock);
+    for(t = threads; t < &threads[NTHREAD]; t++)
+      if(t->stack && t->tid == tid)
+        break;
+    if(t == &threads[NTHREAD]){
+      kmutex_unlock(&tlock);
+      return -1;
+    }
+    if(t->done){
+      free(t->stack);
+      t->stack = 0;
+      kmutex_unlock(&tlock);
+      return 0;
+    }
+    kmutex_unlock(&tlock);
+
+    // wait() may reap some other thread first; remember it.
+    if((pid = wait(0)) < 0)
+      return -1;
+    kmutex_lock(&tlock);
+    for(t = threads; t < &threads[NTHREAD]; t++)
+      if(t->stack && t->tid == pid)
+        t->done = 1;
+    kmutex_unlock(&tlock);
+  }
+}
+
+void
+kmutex_init(struct kmutex *m)
+{
+  m->v = 0;
+}
+
+// Uncontended lock and unlock are one atomic instruction
+// each; only contended ones enter the kernel.
+void
+kmutex_lock(struct kmutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->v, 0, 1)) == 0)
+    return;
+  // Mark the mutex contended, so the holder's unlock knows
+  // to wake someone, and sleep until it is free.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while(c != 0){
+    futex(&m->v, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->v, 2);
+  }
+}
+
+void
+kmutex_unlock(struct kmutex *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __atomic_store_n(&m->v, 0, __ATOMIC_RELEASE);
+    futex(&m->v, FUTEX_WAKE, 1);
+  }
+}
+
+void
+kbarrier_init(struct kbarrier *b, int n)
+{
+  b->n = n;
+  b->count = 0;
+  b->round = 0;
+}
+
+// The last thread to arrive resets the count and starts the
+// next round; the others sleep until the round changes.
+void
+kbarrier_wait(struct kbarrier *b)
+{
+  int round = __atomic_load_n(&b->round, __ATOMIC_ACQUIRE);
+
+  if(__sync_add_and_fetch(&b->count, 1) == b->n){
+    b->count = 0;
+    __atomic_store_n(&b->round, round + 1, __ATOMIC_RELEASE);
+    futex(&b->round, FUTEX_WAKE, b->n);
+  } else {
+    while(__atomic_load_n(&b->round, __ATOMIC_ACQUIRE) == round)
+      futex(&b->round, FUTEX_WAIT, round);
+  }
+}
@@ -0,0 +1,24 @@
+// Kernel-backed threads and futex-based locks.
+//
+// kthread_create() clone()s a thread that shares the caller's
+// memory and can run on another hart. kthread_join() reaps
+// threads with wait(), so a program that joins threads should
+// not also fork() children it waits for.
+
+struct kmutex {
+  volatile int v;        // 0 free, 1 held, 2 held with sleepers
+};
+
+struct kbarrier {
+  int n;                 // threads per round
+  volatile int count;    // threads arrived this round
+  volatile int round;
+};
+
+int kthread_create(void (*fn)(void*), void *arg);
+int kthread_join(int tid);
+void kmutex_init(struct kmutex*);
+void kmutex_lock(struct kmutex*);
+void kmutex_unlock(struct kmutex*);
+void kbarrier_init(struct kbarrier*, int n);
+void kbarrier_wait(struct kbarrier*);
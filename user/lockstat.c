@@ -0,0 +1,59 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+//
+// lockstat [-n N] command [args...]
+// Zero the kernel's lock counters, run command, and print
+// the N most contended lock classes it left behind.
+//
+
+#define NSTAT 64
+
+struct lockstat st[NSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid, top = 10;
+
+  if(argc >= 3 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2 || top <= 0){
+    fprintf(2, "usage: lockstat [-n N] command [args...]\n");
+    exit(1);
+  }
+  if(top > NSTAT)
+    top = NSTAT;
+
+  if(lockstat(LS_RESET, 0, 0) < 0){
+    fprintf(2, "lockstat: reset failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "lockstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+
+  if((n = lockstat(LS_READ, st, top)) < 0){
+    fprintf(2, "lockstat: read failed\n");
+    exit(1);
+  }
+  printf("%s\t\t%s\t%s\t%s\n", "lock", "acquire", "contend", "spin");
+  for(i = 0; i < n; i++)
+    printf("%s\t\t%d\t%d\t%d\n", st[i].name, (int)st[i].nacquire,
+           (int)st[i].ncontend, (int)st[i].nspin);
+  exit(0);
+}
@@ -0,0 +1,103 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+//
+// Stress the kernel's tickslock (a ticket lock) from 1..N
+// processes at once. Each process calls uptime(), which takes
+// tickslock, as fast as it can for a fixed number of ticks.
+// Reports total acquisitions per tick, and fairness as the
+// smallest per-process count over the largest.
+//
+
+#define NMAX     8
+#define DURATION 50   // ticks per round
+
+struct lockstat st[64];
+
+// Run nproc hammering children, and return their
+// summed count in *total and min/max in *lo and *hi.
+void
+hammer(int nproc, int *total, int *lo, int *hi)
+{
+  int fds[2], i, n, start;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "lockstress: pipe failed\n");
+    exit(1);
+  }
+  // Start everyone on the same tick boundary.
+  start = uptime() + 2;
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstress: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      while(uptime() < start)
+        ;
+      n = 0;
+      while(uptime() < start + DURATION)
+        n++;
+      write(fds[1], &n, sizeof(n));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  *total = 0;
+  *lo = -1;
+  *hi = 0;
+  for(i = 0; i < nproc; i++){
+    if(read(fds[0], &n, sizeof(n)) != sizeof(n)){
+      fprintf(2, "lockstress: short read\n");
+      exit(1);
+    }
+    *total += n;
+    if(*lo < 0 || n < *lo)
+      *lo = n;
+    if(n > *hi)
+      *hi = n;
+  }
+  close(fds[0]);
+  for(i = 0; i < nproc; i++)
+    wait(0);
+}
+
+// Spin count for the tickslock class ("time") since the last reset.
+int
+timespins(void)
+{
+  int i, n;
+
+  n = lockstat(LS_READ, st, sizeof(st)/sizeof(st[0]));
+  for(i = 0; i < n; i++)
+    if(strcmp(st[i].name, "time") == 0)
+      return st[i].nspin;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nmax = NMAX, nproc, total, lo, hi;
+
+  if(argc > 1)
+    nmax = atoi(argv[1]);
+  if(nmax < 1 || nmax > NMAX){
+    fprintf(2, "usage: lockstress [nproc<=%d]\n", NMAX);
+    exit(1);
+  }
+
+  printf("nproc\tacq/tick\tfair%%\tspins\n");
+  for(nproc = 1; nproc <= nmax; nproc++){
+    lockstat(LS_RESET, 0, 0);
+    hammer(nproc, &total, &lo, &hi);
+    printf("%d\t%d\t\t%d\t%d\n", nproc, total / DURATION,
+           hi ? lo * 100 / hi : 0, timespins());
+  }
+  exit(0);
+}
@@ -0,0 +1,154 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/kthread.h"
+
+//
+// Concurrent hash table benchmark: notxv6/ph.c on kernel
+// threads, so it runs on several harts of xv6.
+// ph nthread [nbucket]
+// Each thread puts its share of NKEYS random keys into one
+// table with a lock per bucket; then every thread looks up
+// all the keys and reports how many are missing.
+//
+
+#define NKEYS 20000
+#define MAXTHREAD 15    // NTHREAD less the main thread
+
+struct entry {
+  int key;
+  int value;
+  struct entry *next;
+};
+
+int nbucket = 101;
+struct entry **table;
+struct kmutex *locks;
+struct entry entries[NKEYS];   // entries[i] holds keys[i]
+int keys[NKEYS];
+int nthread = 1;
+
+static uint seed = 1;
+
+static int
+rand(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed & 0x7fffffff;
+}
+
+static void
+put(int i, int value)
+{
+  int key = keys[i], b = key % nbucket;
+  struct entry *e;
+
+  kmutex_lock(&locks[b]);
+  for(e = table[b]; e != 0; e = e->next)
+    if(e->key == key)
+      break;
+  if(e){
+    e->value = value;
+  } else {
+    e = &entries[i];
+    e->key = key;
+    e->value = value;
+    e->next = table[b];
+    table[b] = e;
+  }
+  kmutex_unlock(&locks[b]);
+}
+
+// Gets run after all puts have finished, so need no locks.
+static struct entry *
+get(int key)
+{
+  struct entry *e;
+
+  for(e = table[key % nbucket]; e != 0; e = e->next)
+    if(e->key == key)
+      break;
+  return e;
+}
+
+void
+put_thread(void *xa)
+{
+  int n = (int)(uint64)xa;
+  int lo = NKEYS * n / nthread;
+  int hi = NKEYS * (n + 1) / nthread;
+
+  for(int i = lo; i < hi; i++)
+    put(i, n);
+}
+
+void
+get_thread(void *xa)
+{
+  int n = (int)(uint64)xa;
+  int missing = 0;
+
+  for(int i = 0; i < NKEYS; i++)
+    if(get(keys[i]) == 0)
+      missing++;
+  printf("%d: %d keys missing\n", n, missing);
+}
+
+// Run fn on nthread threads and return the ticks it took.
+static int
+run(void (*fn)(void*))
+{
+  int tids[MAXTHREAD];
+  int t0 = uptime();
+
+  for(int i = 0; i < nthread; i++){
+    if((tids[i] = kthread_create(fn, (void*)(uint64)i)) < 0){
+      fprintf(2, "ph: kthread_create failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < nthread; i++)
+    kthread_join(tids[i]);
+  return uptime() - t0;
+}
+
+static void
+report(int n, char *what, int t)
+{
+  printf("%d %s, %d ticks", n, what, t);
+  if(t > 0)
+    printf(", %d %s/tick", n / t, what);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2 || (nthread = atoi(argv[1])) < 1 || nthread > MAXTHREAD){
+    fprintf(2, "usage: ph nthread [nbucket]\n");
+    exit(1);
+  }
+  if(argc > 2 && (nbucket = atoi(argv[2])) < 1){
+    fprintf(2, "ph: bad nbucket\n");
+    exit(1);
+  }
+
+  table = malloc(nbucket * sizeof(table[0]));
+  locks = malloc(nbucket * sizeof(locks[0]));
+  if(table == 0 || locks == 0){
+    fprintf(2, "ph: out of memory\n");
+    exit(1);
+  }
+  for(int i = 0; i < nbucket; i++){
+    table[i] = 0;
+    kmutex_init(&locks[i]);
+  }
+  for(int i = 0; i < NKEYS; i++)
+    keys[i] = rand();
+
+  report(NKEYS, "puts", run(put_thread));
+  report(NKEYS * nthread, "gets", run(get_thread));
+  exit(0);
+}
@@ -0,0 +1,85 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+//
+// Pipe ping-pong latency benchmark.
+// pipelat [nround [nidle]]
+// Bounces a byte between two processes nround times, with
+// nidle extra processes asleep on an unrelated pipe so that
+// wakeup() has other sleepers to skip over.
+//
+
+int
+main(int argc, char *argv[])
+{
+  int nround = 10000, nidle = 32;
+  int ping[2], pong[2], idle[2];
+  int i, pid, t0, t1;
+  char c = 0;
+
+  if(argc > 1)
+    nround = atoi(argv[1]);
+  if(argc > 2)
+    nidle = atoi(argv[2]);
+  if(nround <= 0 || nidle < 0){
+    fprintf(2, "usage: pipelat [nround [nidle]]\n");
+    exit(1);
+  }
+
+  if(pipe(ping) < 0 || pipe(pong) < 0 || pipe(idle) < 0){
+    fprintf(2, "pipelat: pipe failed\n");
+    exit(1);
+  }
+
+  // Idle sleepers block in read() until the write end closes.
+  for(i = 0; i < nidle; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "pipelat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(idle[1]);
+      read(idle[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(idle[0]);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipelat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(idle[1]);
+    for(i = 0; i < nround; i++){
+      if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1){
+        fprintf(2, "pipelat: child i/o failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nround; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "pipelat: parent i/o failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  wait(0);
+
+  close(idle[1]);
+  for(i = 0; i < nidle; i++)
+    wait(0);
+
+  printf("%d round trips, %d idle procs, %d ticks", nround, nidle, t1 - t0);
+  if(t1 > t0)
+    printf(", %d round trips/tick", nround / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,118 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+//
+// Parallel read benchmark.
+// readbench [nproc [kb]]
+//   writes kb kilobytes (default 5120, more than the buffer
+//   cache holds) to files of MAXFILE blocks, then has nproc
+//   processes (default 4) read them back at once, each its own
+//   share of the files, in reads of READSZ bytes. Reports the
+//   ticks the reads took, the disk requests per second (IOPS)
+//   and blocks per request, and the mean queue depth (requests
+//   in flight) and the deepest it has been since boot.
+//
+
+#define READSZ  (32*BSIZE)
+#define FILESZ  (MAXFILE*BSIZE)
+
+char buf[READSZ];
+
+static void
+name(char *path, int i)
+{
+  strcpy(path, "readbench00");
+  path[9] = '0' + i / 10;
+  path[10] = '0' + i % 10;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat a, b;
+  int nproc = 4, kb = 5120, nfile, i, j, n, fd, pid, t0, t1, reqs;
+  char path[16];
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    kb = atoi(argv[2]);
+  nfile = (kb*1024 + FILESZ - 1) / FILESZ;
+  if(argc > 3 || nproc <= 0 || kb <= 0 || nfile > 100){
+    fprintf(2, "usage: readbench [nproc [kb]]\n");
+    exit(1);
+  }
+
+  printf("readbench: writing %d files\n", nfile);
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < nfile; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+      fprintf(2, "readbench: create %s failed\n", path);
+      exit(1);
+    }
+    for(n = 0; n < FILESZ; n += j){
+      j = FILESZ - n < READSZ ? FILESZ - n : READSZ;
+      if(write(fd, buf, j) != j){
+        fprintf(2, "readbench: write %s failed\n", path);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  iostat(&a);
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "readbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = i; j < nfile; j += nproc){
+        name(path, j);
+        if((fd = open(path, O_RDONLY)) < 0){
+          fprintf(2, "readbench: open %s failed\n", path);
+          exit(1);
+        }
+        while((n = read(fd, buf, sizeof(buf))) > 0)
+          ;
+        close(fd);
+        if(n < 0){
+          fprintf(2, "readbench: read %s failed\n", path);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  t1 = uptime();
+  iostat(&b);
+
+  for(i = 0; i < nfile; i++){
+    name(path, i);
+    unlink(path);
+  }
+
+  if(t1 == t0)
+    t1 = t0 + 1;
+  reqs = b.diskreqs - a.diskreqs;
+  printf("readbench: %d procs, %d KB, %d ticks, %d KB per 10 ticks\n",
+         nproc, nfile*FILESZ/1024, t1 - t0, nfile*FILESZ/1024*10 / (t1 - t0));
+  printf("disk: %d requests, %d IOPS", reqs, reqs*10 / (t1 - t0));
+  if(reqs > 0)
+    printf(", %d blocks per request, queue depth %d mean %d most",
+           (int)(b.diskblocks - a.diskblocks) / reqs,
+           (int)(b.diskdepth - a.diskdepth) / reqs, (int)b.diskmaxdepth);
+  printf("\n");
+  printf("prefetch: %d blocks, %d hits, %d misses\n", (int)(b.prefetch - a.prefetch),
+         (int)(b.rahit - a.rahit), (int)(b.ramiss - a.ramiss));
+  exit(0);
+}
@@ -12,6 +12,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXACT  32
 
 struct cmd {
   int type;
@@ -52,6 +53,10 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+void runwait(struct cmd*);
+int canspawn(struct cmd*);
+int spawncmd(struct cmd*, int, int, struct spawnact*, int);
 
 // Execute cmd.  Never returns.
 void
@@ -63,6 +68,7 @@ runcmd(struct cmd *cmd)
   struct listcmd *lcmd;
   struct pipecmd *pcmd;
   struct redircmd *rcmd;
+  struct spawnact redir[MAXACT];
 
   if(cmd == 0)
     exit(1);
@@ -91,13 +97,15 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
+    runwait(lcmd->left);
     runcmd(lcmd->right);
     break;
 
   case PIPE:
+    if(canspawn(cmd)){
+      runwait(cmd);
+      break;
+    }
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
@@ -123,13 +131,122 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
+    if(canspawn(bcmd->cmd))
+      spawncmd(bcmd->cmd, 0, 1, redir, 0);
+    else if(fork1() == 0)
       runcmd(bcmd->cmd);
     break;
   }
   exit(0);
 }
 
+int forkonly;  // sh -f: always fork, to compare with spawn()
+
+// Run cmd and wait for it to finish: by spawning its
+// processes straight from this shell if it can, or else in a
+// forked copy of the shell.
+void
+runwait(struct cmd *cmd)
+{
+  struct spawnact redir[MAXACT];
+  int n;
+
+  if(canspawn(cmd)){
+    for(n = spawncmd(cmd, 0, 1, redir, 0); n > 0; n--)
+      wait(0);
+    return;
+  }
+  if(fork1() == 0)
+    runcmd(cmd);
+  wait(0);
+}
+
+// Can cmd be started with spawn() rather than a forked shell?
+// Commands, commands with redirections, and pipelines of
+// those can. A redirection of a whole pipeline can't, since
+// spawncmd() sets up the pipes first.
+int
+canspawn(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0 || forkonly)
+    return 0;
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    return rcmd->cmd->type != PIPE && canspawn(rcmd->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return canspawn(pcmd->left) && canspawn(pcmd->right);
+  }
+  return 0;
+}
+
+int maxfd = 2;  // highest descriptor a pipe has had in this shell
+
+// Start the processes of cmd, which canspawn(), reading from
+// descriptor in and writing to out, and close in and out
+// unless they are 0 and 1. The nredir entries of redir[]
+// are redirections to make in each process after that.
+// Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd, int in, int out, struct spawnact *redir, int nredir)
+{
+  struct spawnact act[MAXACT];
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+  int p[2], fd, i, j, n = 0;
+
+  switch(cmd->type){
+  case EXEC:
+    // The child's 0 and 1 are in and out, and it gets none of
+    // the shell's other pipe ends.
+    ecmd = (struct execcmd*)cmd;
+    i = 0;
+    if(in != 0)
+      act[i++] = (struct spawnact){ SPAWN_DUP, 0, in, 0 };
+    if(out != 1)
+      act[i++] = (struct spawnact){ SPAWN_DUP, 1, out, 0 };
+    for(fd = 3; fd <= maxfd; fd++)
+      act[i++] = (struct spawnact){ SPAWN_CLOSE, fd, 0, 0 };
+    for(j = 0; j < nredir && i < MAXACT-1; j++)
+      act[i++] = redir[j];
+    act[i].op = SPAWN_END;
+    if(spawn(ecmd->argv[0], ecmd->argv, act) < 0)
+      fprintf(2, "spawn %s failed\n", ecmd->argv[0]);
+    else
+      n = 1;
+    break;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if(nredir < MAXACT)
+      redir[nredir++] = (struct spawnact){ SPAWN_OPEN, rcmd->fd, rcmd->mode, rcmd->file };
+    return spawncmd(rcmd->cmd, in, out, redir, nredir);
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    if(p[1] > maxfd)
+      maxfd = p[1];
+    if(p[0] > maxfd)
+      maxfd = p[0];
+    n = spawncmd(pcmd->left, in, p[1], redir, nredir);
+    return n + spawncmd(pcmd->right, p[0], out, redir, nredir);
+  }
+  if(in != 0)
+    close(in);
+  if(out != 1)
+    close(out);
+  return n;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -142,11 +259,15 @@ getcmd(char *buf, int nbuf)
 }
 
 int
-main(void)
+main(int argc, char *argv[])
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
+  if(argc > 1 && strcmp(argv[1], "-f") == 0)
+    forkonly = 1;
+
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
     if(fd >= 3){
@@ -164,9 +285,10 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) != 0){
+      runwait(cmd);
+      freecmd(cmd);
+    }
   }
   exit(0);
 }
@@ -324,18 +446,36 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so a syntax error is
+// reported and the command dropped, rather than exiting.
+int badsyntax;
+
+void
+syntax(char *msg)
+{
+  if(!badsyntax)
+    fprintf(2, "%s\n", msg);
+  badsyntax = 1;
+}
+
+// Parse the command line s, or return 0 if it is malformed.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  badsyntax = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
   if(s != es){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(badsyntax){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +519,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +547,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +575,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +639,42 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a command tree made by parsecmd(). Its strings are in
+// the line it was parsed from.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
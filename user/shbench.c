@@ -0,0 +1,77 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+//
+// Shell benchmark.
+// shbench [-f] n
+//   writes a script of n three-stage pipelines, runs sh on it
+//   with its output going to a scratch file, and reports the
+//   ticks it took and the commands run per 100 ticks. With
+//   -f, runs sh -f, which forks a shell for every command
+//   line and pipeline stage instead of using spawn().
+//
+
+#define SCRIPT "shbench.sh"
+#define OUT    "shbench.out"
+
+char line[] = "echo one two three | grep two | wc\n";
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "sh", 0, 0 };
+  int n, i, fd, pid, t0, t1;
+
+  if(argc > 1 && strcmp(argv[1], "-f") == 0){
+    args[1] = "-f";
+    argc--;
+    argv++;
+  }
+  if(argc != 2 || (n = atoi(argv[1])) < 1){
+    fprintf(2, "usage: shbench [-f] n\n");
+    exit(1);
+  }
+
+  if((fd = open(SCRIPT, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    fprintf(2, "shbench: can't create %s\n", SCRIPT);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(write(fd, line, sizeof(line) - 1) != sizeof(line) - 1){
+      fprintf(2, "shbench: write %s failed\n", SCRIPT);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "shbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    if(open(SCRIPT, O_RDONLY) != 0)
+      exit(1);
+    close(1);
+    if(open(OUT, O_CREATE|O_WRONLY|O_TRUNC) != 1)
+      exit(1);
+    close(2);
+    dup(1);
+    exec("sh", args);
+    exit(1);
+  }
+  wait(0);
+  t1 = uptime();
+
+  unlink(SCRIPT);
+  unlink(OUT);
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("%s: %d pipelines, %d commands, %d ticks, %d commands per 100 ticks\n",
+         args[1] ? "sh -f" : "sh", n, 3*n, t1 - t0, 3*n*100 / (t1 - t0));
+  exit(0);
+}
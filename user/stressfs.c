@@ -9,10 +9,64 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/iostat.h"
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 
+//
+// stressfs -s [kb]
+//   sequential write benchmark: writes kb kilobytes (default
+//   1024) to files of at most MAXFILE blocks, each with one
+//   write() and an fsync(), and reports the throughput and
+//   the log commits it took.
+//
+static void
+seqwrite(int kb)
+{
+  char path[] = "stressfs.s0";
+  struct iostat a, b;
+  int fd, n, left, t0, t1, commits;
+  char *buf;
+
+  if((buf = malloc(MAXFILE*BSIZE)) == 0){
+    fprintf(2, "stressfs: out of memory\n");
+    exit(1);
+  }
+  memset(buf, 's', MAXFILE*BSIZE);
+
+  iostat(&a);
+  t0 = uptime();
+  for(left = kb*1024; left > 0; left -= n){
+    n = left < MAXFILE*BSIZE ? left : MAXFILE*BSIZE;
+    if((fd = open(path, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+      fprintf(2, "stressfs: create %s failed\n", path);
+      exit(1);
+    }
+    if(write(fd, buf, n) != n || fsync(fd) != 0){
+      fprintf(2, "stressfs: write %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+    path[sizeof(path)-2]++;
+  }
+  t1 = uptime();
+  iostat(&b);
+
+  while(path[sizeof(path)-2]-- > '0')
+    unlink(path);
+
+  if(t1 == t0)
+    t1 = t0 + 1;
+  commits = b.commits - a.commits;
+  printf("seqwrite: %d KB, %d ticks, %d KB per 10 ticks\n",
+         kb, t1 - t0, kb*10 / (t1 - t0));
+  if(commits > 0)
+    printf("log: %d commits, %d blocks and %d us per commit\n", commits,
+           (int)(b.commitblocks - a.commitblocks) / commits,
+           (int)((b.committime - a.committime) / 10 / commits));
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -20,6 +74,16 @@ main(int argc, char *argv[])
   char path[] = "stressfs0";
   char data[512];
 
+  if(argc > 1 && strcmp(argv[1], "-s") == 0){
+    i = argc > 2 ? atoi(argv[2]) : 1024;
+    if(i <= 0 || argc > 3){
+      fprintf(2, "usage: stressfs [-s [kb]]\n");
+      exit(1);
+    }
+    seqwrite(i);
+    exit(0);
+  }
+
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
 
@@ -0,0 +1,81 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+//
+// TLB stride benchmark.
+// stridebench mb rounds
+//   grows the heap by mb megabytes in one sbrk(), touches each
+//   page, then reads one byte of every page, rounds times over,
+//   and reports the ticks each part took and how the heap was
+//   filled in. Whole superpages of the heap are filled in on
+//   first touch as superpages.
+// stridebench -p mb rounds
+//   grows the heap a page at a time, touching each page as it
+//   goes, so no superpage fits and every page is mapped alone.
+// Comparing the two shows what superpages save in page faults,
+// page-table pages and TLB misses. qemu's software TLB caches
+// pages of a superpage one at a time, so the stride part gains
+// less under qemu than on hardware.
+//
+
+int
+main(int argc, char *argv[])
+{
+  struct vmstat a, b;
+  int bypage = 0, mb, rounds, n, i, r, t0, t1, t2;
+  volatile char *p;
+  char *q;
+  uint64 sum = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-p") == 0){
+    bypage = 1;
+    argc--;
+    argv++;
+  }
+  if(argc != 3 || (mb = atoi(argv[1])) <= 0 || (rounds = atoi(argv[2])) <= 0){
+    fprintf(2, "usage: stridebench [-p] mb rounds\n");
+    exit(1);
+  }
+  n = mb * 1024 * 1024;
+
+  vmstat(&a);
+  t0 = uptime();
+  if(bypage){
+    p = 0;
+    for(i = 0; i < n; i += PGSIZE){
+      if((q = sbrk(PGSIZE)) == (char*)-1){
+        fprintf(2, "stridebench: out of memory\n");
+        exit(1);
+      }
+      if(p == 0)
+        p = q;
+      q[0] = 1;
+    }
+  } else {
+    if((p = sbrk(n)) == (char*)-1){
+      fprintf(2, "stridebench: out of memory\n");
+      exit(1);
+    }
+    for(i = 0; i < n; i += PGSIZE)
+      p[i] = 1;
+  }
+  t1 = uptime();
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < n; i += PGSIZE)
+      sum += p[i];
+  t2 = uptime();
+  vmstat(&b);
+
+  if(sum != (uint64)rounds * (n / PGSIZE)){
+    fprintf(2, "stridebench: read back wrong data\n");
+    exit(1);
+  }
+  printf("touch %d ticks, stride %d ticks\n", t1 - t0, t2 - t1);
+  printf("filled %d superpages, %d pages\n", (int)(b.superfill - a.superfill),
+         (int)(b.lazyfill - a.lazyfill));
+  exit(0);
+}
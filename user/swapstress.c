@@ -0,0 +1,101 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+//
+// Paging stress test.
+// swapstress [mb [rounds]]
+//   grows the heap by mb megabytes (default 256, twice the
+//   machine's memory), writes a different value into every
+//   page, then reads them all back, rounds times over (default
+//   1), checking each. Memory runs out part way through the
+//   first pass, so the kernel must page out to swap to go on.
+//   Reports the ticks each pass took, and the page faults and
+//   the pages paged out and in, in all and per 10 ticks.
+//   Before the first pass it also writes a tiny function into
+//   a page of its own, and calls it after the pass, by which
+//   time the page has most likely gone out to swap, to check
+//   that code comes back in on an instruction fetch.
+//
+
+static void
+report(char *what, struct vmstat *a, struct vmstat *b, int ticks)
+{
+  int faults = b->faults - a->faults;
+  int out = b->swapout - a->swapout;
+  int in = b->swapin - a->swapin;
+
+  if(ticks == 0)
+    ticks = 1;
+  printf("%s: %d ticks, %d faults (%d/10t), out %d (%d/10t), in %d (%d/10t)\n",
+         what, ticks, faults, faults*10/ticks, out, out*10/ticks, in, in*10/ticks);
+}
+
+// li a0, 42; ret
+static uint32 code[] = { 0x02a00513, 0x00008067 };
+
+int
+main(int argc, char *argv[])
+{
+  struct vmstat a, b, c, d;
+  int mb = 256, rounds = 1, npage, i, r, t0, t1, t2;
+  uint64 *p;
+  char *text;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(argc > 3 || mb <= 0 || rounds <= 0){
+    fprintf(2, "usage: swapstress [mb [rounds]]\n");
+    exit(1);
+  }
+  npage = mb * (1024 * 1024 / PGSIZE);
+
+  if((text = sbrk(2 * PGSIZE)) == (char*)-1){
+    fprintf(2, "swapstress: sbrk failed\n");
+    exit(1);
+  }
+  text = (char*)PGROUNDUP((uint64)text);
+  memmove(text, code, sizeof(code));
+  asm volatile("fence.i");
+
+  if((p = (uint64*)sbrk(mb * 1024 * 1024)) == (uint64*)-1){
+    fprintf(2, "swapstress: sbrk failed\n");
+    exit(1);
+  }
+
+  vmstat(&a);
+  t0 = uptime();
+  for(i = 0; i < npage; i++)
+    p[i * (PGSIZE / sizeof(uint64))] = i * 7 + 1;
+  t1 = uptime();
+  vmstat(&b);
+
+  if(((int (*)(void))text)() != 42){
+    fprintf(2, "swapstress: code page ran wrong\n");
+    exit(1);
+  }
+  vmstat(&d);
+  printf("code page %s\n", d.swapin != b.swapin ? "came back in from swap" : "stayed in memory");
+  vmstat(&b);
+
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < npage; i++){
+      if(p[i * (PGSIZE / sizeof(uint64))] != i * 7 + 1){
+        fprintf(2, "swapstress: page %d read back wrong\n", i);
+        exit(1);
+      }
+    }
+  }
+  t2 = uptime();
+  vmstat(&c);
+
+  printf("%d pages, %d free at the end\n", npage, (int)c.freepages);
+  report("write", &a, &b, t1 - t0);
+  report("read", &b, &c, t2 - t1);
+  exit(0);
+}
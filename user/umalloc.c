@@ -2,9 +2,11 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "user/kthread.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+// One lock serializes threads sharing the heap.
 
 typedef long Align;
 
@@ -20,9 +22,10 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static struct kmutex lock;
 
-void
-free(void *ap)
+static void
+freelocked(void *ap)
 {
   Header *bp, *p;
 
@@ -43,6 +46,14 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  kmutex_lock(&lock);
+  freelocked(ap);
+  kmutex_unlock(&lock);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,7 +67,7 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  freelocked((void*)(hp + 1));
   return freep;
 }
 
@@ -66,6 +77,7 @@ malloc(uint nbytes)
   Header *p, *prevp;
   uint nunits;
 
+  kmutex_lock(&lock);
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
@@ -81,10 +93,13 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      kmutex_unlock(&lock);
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        kmutex_unlock(&lock);
         return 0;
+      }
   }
 }
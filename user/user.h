@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct vmstat;
+struct iostat;
+struct spawnact;
 
 // system calls
 int fork(void);
@@ -23,6 +27,17 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockstat(int, struct lockstat*, int);
+int sigalarm(int ticks, void (*handler)(void*));
+int sigreturn(void*);
+int clone(void (*fn)(void*), void *arg, void *stack);
+int futex(volatile int*, int, int);
+int vmstat(struct vmstat*);
+void *mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int spawn(char*, char**, struct spawnact*);
+int fsync(int);
+int iostat(struct iostat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
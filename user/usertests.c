@@ -2,11 +2,14 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "user/kthread.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/vmstat.h"
+#include "kernel/iostat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2587,6 +2590,792 @@ badarg(char *s)
   exit(0);
 }
 
+volatile int nalarm;
+
+void
+alarmhandler(void *frame)
+{
+  nalarm++;
+  sigreturn(frame);
+}
+
+// alarm upcalls must interrupt a process that never makes a
+// system call, and sigreturn() must resume it with all of its
+// registers intact.
+void
+sigalarmtest(char *s)
+{
+  uint64 sum = 0;
+  int i, t0;
+
+  if(sigalarm(1, alarmhandler) < 0){
+    printf("%s: sigalarm failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; nalarm < 3; i++){
+    sum += 7 * (uint64)i;
+    if((i & 0xfffff) == 0 && uptime() - t0 > 100)
+      break;
+  }
+  sigalarm(0, 0);
+  if(nalarm < 3){
+    printf("%s: only %d alarm upcalls\n", s, nalarm);
+    exit(1);
+  }
+  if(sum != 7 * (uint64)i * (i - 1) / 2){
+    printf("%s: registers corrupted by upcall\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+struct kmutex clonelock;
+volatile int clonecount;
+char *clonebuf;
+int cloneshrank;
+
+void
+clonethread(void *arg)
+{
+  for(int i = 0; i < 1000; i++){
+    kmutex_lock(&clonelock);
+    clonecount++;
+    kmutex_unlock(&clonelock);
+  }
+  // memory a thread allocates is visible to the others.
+  if((uint64)arg == 0)
+    clonebuf = sbrk(PGSIZE);
+  // but none may shrink it while others may be running.
+  if((uint64)arg == 1 && sbrk(-1) != (char*)-1)
+    cloneshrank = 1;
+}
+
+// threads made by clone() share memory, and kmutex keeps
+// their updates from being lost.
+void
+clonetest(char *s)
+{
+  int tids[4];
+
+  kmutex_init(&clonelock);
+  for(int i = 0; i < 4; i++){
+    if((tids[i] = kthread_create(clonethread, (void*)(uint64)i)) < 0){
+      printf("%s: kthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(int i = 0; i < 4; i++){
+    if(kthread_join(tids[i]) < 0){
+      printf("%s: kthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(clonecount != 4000){
+    printf("%s: count %d, expected 4000\n", s, clonecount);
+    exit(1);
+  }
+  if(clonebuf == (char*)-1 || clonebuf == 0){
+    printf("%s: sbrk in thread failed\n", s);
+    exit(1);
+  }
+  if(cloneshrank){
+    printf("%s: sbrk(-n) in thread succeeded\n", s);
+    exit(1);
+  }
+  clonebuf[PGSIZE-1] = 1;
+  exit(0);
+}
+
+// fork() shares pages copy-on-write: a store by either
+// process must not be seen by the other, including stores
+// the kernel makes on the child's behalf with copyout().
+void
+cowfork(char *s)
+{
+  int npages = 32, pid, fds[2];
+  char *p = sbrk(npages * PGSIZE);
+
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < npages; i++)
+    p[i*PGSIZE] = 'p';
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < npages; i++){
+      if(p[i*PGSIZE] != 'p')
+        exit(1);
+      p[i*PGSIZE] = 'c';
+    }
+    // read() into a shared page goes through copyout().
+    if(read(fds[0], p + PGSIZE + 1, 1) != 1 || p[PGSIZE+1] != 'x')
+      exit(1);
+    exit(0);
+  }
+  if(write(fds[1], "x", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < npages; i++){
+    if(p[i*PGSIZE] != 'p'){
+      printf("%s: child's store leaked into parent\n", s);
+      exit(1);
+    }
+  }
+  if(p[PGSIZE+1] == 'x'){
+    printf("%s: child's read leaked into parent\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// sbrk() only reserves address space; pages appear when
+// touched, whether by the process or by a system call, and
+// fork() and sbrk(-n) cope with the untouched holes.
+void
+lazyheap(char *s)
+{
+  enum { BIG = 1024*1024*1024 };
+  struct vmstat a, b;
+  char *p;
+  int fds[2], pid, xstatus;
+
+  vmstat(&a);
+  p = sbrk(BIG);
+  if(p == (char*)-1){
+    printf("%s: sbrk of untouched memory failed\n", s);
+    exit(1);
+  }
+  vmstat(&b);
+  if(b.lazyfill != a.lazyfill){
+    printf("%s: sbrk allocated pages\n", s);
+    exit(1);
+  }
+  if(p[BIG/2] != 0 || p[BIG-1] != 0){
+    printf("%s: new heap not zero\n", s);
+    exit(1);
+  }
+  p[0] = 'a';
+  p[BIG-1] = 'z';
+
+  // write() copies in from an untouched page, read() copies
+  // out to another.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], p + BIG/4, 8) != 8 || read(fds[0], p + 3*(BIG/4), 8) != 8){
+    printf("%s: copy to or from untouched page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[0] != 'a' || p[BIG-1] != 'z' || p[BIG/8] != 0)
+      exit(1);
+    p[BIG/8] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong heap\n", s);
+    exit(1);
+  }
+  if(p[BIG/8] != 0){
+    printf("%s: child's page leaked into parent\n", s);
+    exit(1);
+  }
+
+  // jump into an untouched page. the fetch fills it in with
+  // zeroes, which then don't decode, so the child is killed,
+  // but only after the page was filled.
+  vmstat(&a);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    ((void (*)(void))(p + 5*(BIG/8)))();
+    exit(0);
+  }
+  wait(&xstatus);
+  vmstat(&b);
+  if(xstatus != -1){
+    printf("%s: code in an untouched page didn't fault\n", s);
+    exit(1);
+  }
+  if(b.lazyfill == a.lazyfill && b.superfill == a.superfill){
+    printf("%s: fetch didn't fill in the page\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-BIG) == (char*)-1){
+    printf("%s: sbrk(-n) over holes failed\n", s);
+    exit(1);
+  }
+}
+
+// exec() reads a program's pages as they are touched, and a
+// second run of the same program finds them in the page cache.
+void
+execshare(char *s)
+{
+  struct vmstat a, b;
+  char *args[] = { "echo", "x", 0 };
+  int pid, xstatus;
+
+  for(int i = 0; i < 2; i++){
+    vmstat(&a);
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      exec("echo", args);
+      exit(1);
+    }
+    wait(&xstatus);
+    vmstat(&b);
+    if(xstatus != 0){
+      printf("%s: exec echo failed\n", s);
+      exit(1);
+    }
+    if(b.filefill == a.filefill){
+      printf("%s: no program pages filled on demand\n", s);
+      exit(1);
+    }
+  }
+  if(b.filecached == a.filecached){
+    printf("%s: second run shared no cached pages\n", s);
+    exit(1);
+  }
+}
+
+// mmap() a file private and shared: check the data, that
+// private stores stay private, that shared stores (including
+// by a forked child and by read()) reach the file, and that
+// munmap() can punch a hole in a mapping.
+void
+mmaptest(char *s)
+{
+  enum { N = 2*PGSIZE + PGSIZE/2 };
+  char *f = "mmapfile", *p;
+  int fd, i, pid, xstatus, fds[2];
+
+  fd = open(f, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, f);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    char c = 'a' + i % 26;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(p[i] != 'a' + i % 26){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(p[N] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: past end of file not zero\n", s);
+    exit(1);
+  }
+  p[0] = 'P';
+  if(munmap(p, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a'){
+    printf("%s: private store reached the file\n", s);
+    exit(1);
+  }
+  p[1] = 'S';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[1] != 'S')
+      exit(1);
+    p[PGSIZE] = 'C';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[PGSIZE] != 'C'){
+    printf("%s: shared page not shared with child\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0 || write(fds[1], "R", 1) != 1 || read(fds[0], p + 2*PGSIZE, 1) != 1){
+    printf("%s: read() into mapping failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || p[2*PGSIZE] != 'R' || munmap(p, N) < 0){
+    printf("%s: munmap of middle page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(f, O_RDONLY);
+  char buf[4];
+  if(read(fd, buf, 2) != 2 || buf[0] != 'a' || buf[1] != 'S'){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open(f, O_RDWR);
+  p = mmap(0, N, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || p[PGSIZE] != 'C' || p[2*PGSIZE] != 'R'){
+    printf("%s: child's or read()'s store not written back\n", s);
+    exit(1);
+  }
+  // write() shows up in a mapping of the file.
+  if(write(fd, "W", 1) != 1 || p[0] != 'W'){
+    printf("%s: write() not seen through mapping\n", s);
+    exit(1);
+  }
+  munmap(p, N);
+  close(fd);
+  unlink(f);
+}
+
+// the kernel copies to and from user memory through a view of
+// it in the kernel page table. a fault there has to fail the
+// system call rather than panic the kernel.
+void
+copyview(char *s)
+{
+  int fds[2];
+  char *guard = (char *) PGROUNDDOWN(r_sp()) - PGSIZE;
+  char *top = sbrk(0);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "abcd", 4) != 4){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], guard, 1) > 0){
+    printf("%s: read into stack guard page\n", s);
+    exit(1);
+  }
+  if(write(fds[1], guard, 1) > 0){
+    printf("%s: write from stack guard page\n", s);
+    exit(1);
+  }
+  if(read(fds[0], top + PGSIZE, 1) > 0){
+    printf("%s: read past end of memory\n", s);
+    exit(1);
+  }
+  if(write(fds[1], top + PGSIZE, 1) > 0){
+    printf("%s: write from past end of memory\n", s);
+    exit(1);
+  }
+
+  // a path that runs into the end of memory.
+  char *p = sbrk(PGSIZE);
+  memset(p, 'a', PGSIZE);
+  if(open(p + PGSIZE - 16, O_RDONLY) >= 0){
+    printf("%s: open of unterminated path\n", s);
+    exit(1);
+  }
+  sbrk(-PGSIZE);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a heap grown in one sbrk() may be filled in a superpage at
+// a time. sharing one with fork(), copying out to it, and
+// splitting it by shrinking the heap must all keep its contents.
+void
+superpage(char *s)
+{
+  enum { N = 3*SUPERPGSIZE };
+  char *p, *q;
+  int i, fds[2], pid, xstatus;
+
+  p = sbrk(N);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  q = (char*)SUPERPGROUNDUP((uint64)p);
+  for(i = 0; i < SUPERPGSIZE; i += PGSIZE)
+    q[i] = i / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < SUPERPGSIZE; i += PGSIZE)
+      if(q[i] != (char)(i / PGSIZE))
+        exit(1);
+    q[PGSIZE] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong superpage\n", s);
+    exit(1);
+  }
+  if(q[PGSIZE] != 1){
+    printf("%s: child's store leaked into parent\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "xy", 2) != 2 || read(fds[0], q + 5*PGSIZE + 1, 2) != 2 ||
+     q[5*PGSIZE + 1] != 'x' || q[5*PGSIZE + 2] != 'y'){
+    printf("%s: read into superpage failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // cut the heap off in the middle of the superpage.
+  sbrk((q + SUPERPGSIZE/2) - sbrk(0));
+  for(i = 0; i < SUPERPGSIZE/2; i += PGSIZE){
+    if(q[i] != (char)(i / PGSIZE)){
+      printf("%s: split superpage lost page %d\n", s, i / PGSIZE);
+      exit(1);
+    }
+  }
+  sbrk(p - sbrk(0));
+}
+
+// spawn() starts a program with its descriptors rearranged
+// by the file actions, and leaves the caller's alone.
+void
+spawntest(char *s)
+{
+  int fds[2], pid, xstatus, n;
+  char buf[32];
+  char *echo[] = { "echo", "spawned", 0 };
+  struct spawnact act[] = {
+    { SPAWN_DUP, 1, 0, 0 },
+    { SPAWN_CLOSE, 0, 0, 0 },
+    { SPAWN_END, 0, 0, 0 },
+  };
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].arg = fds[1];
+  act[1].fd = fds[0];
+  pid = spawn("echo", echo, act);
+  if(pid < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  n = read(fds[0], buf, sizeof(buf) - 1);
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output from spawned echo\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 1) != 0){
+    printf("%s: spawned echo kept the pipe open\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wrong exit from spawned echo\n", s);
+    exit(1);
+  }
+
+  if(spawn("nonexistent", echo, 0) >= 0){
+    printf("%s: spawn of nonexistent program succeeded\n", s);
+    exit(1);
+  }
+  act[0] = (struct spawnact){ SPAWN_DUP, 1, NOFILE, 0 };
+  if(spawn("echo", echo, act) >= 0){
+    printf("%s: spawn with bad descriptor succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// several processes write and fsync() files at once, so
+// their operations share transactions with the flusher's.
+void
+fsynctest(char *s)
+{
+  enum { NCHILD = 4, NWRITE = 20 };
+  char name[8], buf[64];
+  int i, j, fd, pid, xstatus;
+  struct iostat a, b;
+
+  if(fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of a bad descriptor succeeded\n", s);
+    exit(1);
+  }
+  if(iostat(&a) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      strcpy(name, "fsync0");
+      name[5] = '0' + i;
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      memset(buf, 'a' + i, sizeof(buf));
+      for(j = 0; j < NWRITE; j++){
+        if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        if(j % 5 == 0 && fsync(fd) != 0){
+          printf("%s: fsync %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      if(fsync(fd) != 0){
+        printf("%s: fsync %s failed\n", s, name);
+        exit(1);
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  if(iostat(&b) < 0 || b.commits <= a.commits){
+    printf("%s: fsync committed nothing\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    strcpy(name, "fsync0");
+    name[5] = '0' + i;
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    for(j = 0; j < NWRITE; j++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+         buf[0] != 'a' + i || buf[sizeof(buf)-1] != 'a' + i){
+        printf("%s: %s read back wrong\n", s, name);
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink(name);
+  }
+}
+
+// fill a file of MAXFILE blocks with one write() from an
+// unaligned offset, which the log takes in one transaction,
+// and one more byte, which doesn't fit.
+void
+maxwrite(char *s)
+{
+  int fd, i, n = MAXFILE*BSIZE - 100;
+  char *p;
+
+  if((p = malloc(n)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    p[i] = i % 251;
+  fd = open("maxwrite", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create maxwrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, 100) != 100 || write(fd, p, n) != n){
+    printf("%s: write of %d bytes failed\n", s, n);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != -1){
+    printf("%s: write past MAXFILE succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(p, 0, n);
+  fd = open("maxwrite", O_RDONLY);
+  if(fd < 0 || read(fd, p, 100) != 100 || read(fd, p, n) != n){
+    printf("%s: read maxwrite failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != (char)(i % 251)){
+      printf("%s: maxwrite byte %d read back wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("maxwrite");
+  free(p);
+}
+
+// read a file in pieces of odd sizes, so that read-ahead runs
+// up to the end of the file, and break the run with a write
+// through the same descriptor.
+void
+readahead(char *s)
+{
+  enum { N = 100*BSIZE + 123 };
+  char b[700];
+  int fd, i, n, off, wrote = 0;
+
+  fd = open("readahead", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create readahead failed\n", s);
+    exit(1);
+  }
+  for(off = 0; off < N; off += n){
+    n = N - off < sizeof(b) ? N - off : sizeof(b);
+    for(i = 0; i < n; i++)
+      b[i] = (off + i) % 253;
+    if(write(fd, b, n) != n){
+      printf("%s: write readahead failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("readahead", O_RDWR);
+  if(fd < 0){
+    printf("%s: open readahead failed\n", s);
+    exit(1);
+  }
+  for(off = 0; ; off += n){
+    if(!wrote && off >= 20*BSIZE){
+      // off moves past what a read expected, ending the run.
+      wrote = 1;
+      b[0] = off % 253;
+      if(write(fd, b, 1) != 1){
+        printf("%s: write readahead failed\n", s);
+        exit(1);
+      }
+      off++;
+    }
+    n = read(fd, b, (off % 3) ? 511 : 700);
+    if(n < 0){
+      printf("%s: read readahead failed\n", s);
+      exit(1);
+    }
+    if(n == 0)
+      break;
+    for(i = 0; i < n; i++){
+      if(b[i] != (char)((off + i) % 253)){
+        printf("%s: byte %d read back wrong\n", s, off + i);
+        exit(1);
+      }
+    }
+  }
+  if(off != N){
+    printf("%s: read %d bytes, not %d\n", s, off, N);
+    exit(1);
+  }
+  close(fd);
+  unlink("readahead");
+}
+
+// exec maps none of the program up front: its code pages
+// come in on instruction-fetch faults. run a program that
+// makes no read() or write() calls, so no system call
+// faults its pages in for it, and check it gets to exit().
+void
+exectext(char *s)
+{
+  char *args[] = { "zombie", 0 };
+  struct vmstat a, b;
+  int pid, xstatus;
+
+  vmstat(&a);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exec("zombie", args);
+    printf("%s: exec zombie failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: zombie didn't run to completion\n", s);
+    exit(1);
+  }
+  vmstat(&b);
+  if(b.faults == a.faults){
+    printf("%s: no page faults running zombie\n", s);
+    exit(1);
+  }
+}
+
 // test the exec() code that cleans up if it runs out
 // of memory. it's really a test that such a condition
 // doesn't cause a panic.
@@ -2752,6 +3541,19 @@ main(int argc, char *argv[])
     {sbrkbugs, "sbrkbugs" },
     // {badwrite, "badwrite" },
     {badarg, "badarg" },
+    {sigalarmtest, "sigalarm" },
+    {clonetest, "clone" },
+    {cowfork, "cowfork" },
+    {lazyheap, "lazyheap" },
+    {execshare, "execshare" },
+    {mmaptest, "mmaptest" },
+    {copyview, "copyview" },
+    {superpage, "superpage" },
+    {spawntest, "spawntest" },
+    {fsynctest, "fsynctest" },
+    {maxwrite, "maxwrite" },
+    {readahead, "readahead" },
+    {exectext, "exectext" },
     {reparent, "reparent" },
     {twochildren, "twochildren"},
     {forkfork, "forkfork"},
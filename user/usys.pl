@@ -36,3 +36,14 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("lockstat");
+entry("sigalarm");
+entry("sigreturn");
+entry("clone");
+entry("futex");
+entry("vmstat");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("fsync");
+entry("iostat");
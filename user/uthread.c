@@ -2,13 +2,36 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
+//
+// User-level threads.
+//
+// Threads are scheduled from NPRIO FIFO ready queues, lowest
+// number first; picking the next thread never scans the
+// thread set. Stacks and thread structs come from malloc()
+// and are recycled through free lists when a thread is joined.
+//
+// thread_join(), mutexes and condition variables park the
+// caller off the ready queue until it is handed the thing it
+// waits for.
+//
+// thread_preempt(n) asks the kernel for an alarm upcall every
+// n ticks and yields from it, so threads that never call into
+// the library still take turns. Library code runs with
+// upcalls deferred (see enter()/leave()). Threads that call
+// malloc() themselves must not be preempted inside it; wrap
+// such calls in a mutex.
+//
+
 /* Possible states of a thread: */
 #define FREE        0x0
 #define RUNNING     0x1
 #define RUNNABLE    0x2
+#define BLOCKED     0x3    /* parked on a join, mutex or condvar */
+#define ZOMBIE      0x4    /* exited, waiting for thread_join */
 
 #define STACK_SIZE  8192
-#define MAX_THREAD  4
+#define NPRIO       4      /* ready queue levels; 0 runs first */
+#define DEFPRIO     2
 
 //context结构体保存线程上下文（保存被调用者保存的寄存器）
 struct thread_context{
@@ -30,92 +53,388 @@ struct thread_context{
 
 
 struct thread {
-  char       stack[STACK_SIZE]; /* the thread's stack */
-  int        state;             /* FREE, RUNNING, RUNNABLE */
+  char       *stack;            /* the thread's stack; 0 for main */
+  int        state;             /* FREE, RUNNING, RUNNABLE, ... */
+  int        prio;              /* ready queue it goes on */
+  int        id;
+  void       (*func)();         /* entry point */
+  struct thread *next;          /* ready/wait queue or free list link */
+  struct thread *joiner;        /* parked in thread_join on us */
 
   struct thread_context context;//保存线程上下文结构体
 };
-struct thread all_thread[MAX_THREAD];
+
+struct tqueue {
+  struct thread *head;
+  struct thread *tail;
+};
+
+struct thread_mutex {
+  int locked;
+  struct thread *owner;
+  struct tqueue waiters;
+};
+
+struct thread_cond {
+  struct tqueue waiters;
+};
+
+struct thread main_thread;
 struct thread *current_thread;
 extern void thread_switch(uint64, uint64);
-              
-void 
-thread_init(void)
+
+static struct tqueue ready[NPRIO];
+static uint readymask;              /* bit i set iff ready[i] is non-empty */
+static struct thread *freethreads;  /* joined thread structs */
+static char *freestacks;            /* joined stacks, linked through word 0 */
+static int nextid = 1;
+static uint64 nswitch;              /* context switches so far */
+
+static volatile int nopreempt;      /* > 0 while inside the library */
+static volatile int pending;        /* an upcall arrived during nopreempt */
+static int quantum;                 /* ticks per preemption, 0 if off */
+
+void thread_yield(void);
+void thread_exit(void);
+
+// Library code manipulates queues that an upcall's
+// thread_yield() would also touch, so it runs between
+// enter() and leave(), and upcalls that land in between
+// are replayed by leave(). Threads only switch at depth 1,
+// so the count stays right across thread_switch().
+static void
+enter(void)
 {
-  // main() is thread 0, which will make the first invocation to
-  // thread_schedule().  it needs a stack so that the first thread_switch() can
-  // save thread 0's state.  thread_schedule() won't run the main thread ever
-  // again, because its state is set to RUNNING, and thread_schedule() selects
-  // a RUNNABLE thread.
-  current_thread = &all_thread[0];
-  current_thread->state = RUNNING;
+  nopreempt++;
+  asm volatile("" ::: "memory");
 }
 
-void 
-thread_schedule(void)
+static void
+leave(void)
+{
+  asm volatile("" ::: "memory");
+  if(--nopreempt == 0 && pending){
+    pending = 0;
+    thread_yield();
+  }
+}
+
+static void
+tq_push(struct tqueue *q, struct thread *t)
 {
-  struct thread *t, *next_thread;
-
-  /* Find another runnable thread. */
-  next_thread = 0;
-  t = current_thread + 1;
-  for(int i = 0; i < MAX_THREAD; i++){
-    if(t >= all_thread + MAX_THREAD)
-      t = all_thread;
-    if(t->state == RUNNABLE) {
-      next_thread = t;
-      break;
+  t->next = 0;
+  if(q->tail)
+    q->tail->next = t;
+  else
+    q->head = t;
+  q->tail = t;
+}
+
+static struct thread *
+tq_pop(struct tqueue *q)
+{
+  struct thread *t = q->head;
+
+  if(t){
+    q->head = t->next;
+    if(q->head == 0)
+      q->tail = 0;
+    t->next = 0;
+  }
+  return t;
+}
+
+static void
+ready_push(struct thread *t)
+{
+  t->state = RUNNABLE;
+  tq_push(&ready[t->prio], t);
+  readymask |= 1 << t->prio;
+}
+
+static struct thread *
+ready_pop(void)
+{
+  struct thread *t;
+
+  for(int i = 0; i < NPRIO; i++){
+    if(readymask & (1 << i)){
+      t = tq_pop(&ready[i]);
+      if(ready[i].head == 0)
+        readymask &= ~(1 << i);
+      return t;
     }
-    t = t + 1;
   }
+  return 0;
+}
+
+// Switch to the next ready thread. The caller has already put
+// current_thread on a queue, or parked it, or is exiting.
+// Must be called between enter() and leave().
+static void
+sched(void)
+{
+  struct thread *t = current_thread;
+  struct thread *next_thread = ready_pop();
 
   if (next_thread == 0) {
     printf("thread_schedule: no runnable threads\n");
     exit(-1);
   }
 
+  next_thread->state = RUNNING;
   if (current_thread != next_thread) {         /* switch threads?  */
-    next_thread->state = RUNNING;
-    t = current_thread;
     current_thread = next_thread;
-    /* YOUR CODE HERE
-     * Invoke thread_switch to switch from t to next_thread:
-     * thread_switch(??, ??);
-     */
+    nswitch++;
     //通过这里对上下文进行保护和恢复，并通过设置ra寄存器和ret指令来恢复下一个线程的执行
     //thread_switch:汇编直接操作
     thread_switch((uint64)&t->context,(uint64)&next_thread->context);
-  } else
-    next_thread = 0;
+  }
 }
 
-//让ra指向线程的入口函数，sp和fp指向栈底,栈底:t->stack[STACK_SIZE-1]
-void 
+void
+thread_init(void)
+{
+  // main() is thread 0. It needs a thread struct so that the
+  // first thread_switch() can save its state, but it runs on
+  // the process stack. It only runs again if it puts itself
+  // on the ready queue or something wakes it.
+  main_thread.state = RUNNING;
+  main_thread.prio = DEFPRIO;
+  current_thread = &main_thread;
+}
+
+// Give up the CPU without yielding it: main() calls this to
+// hand over to the threads it created for good.
+void
+thread_schedule(void)
+{
+  enter();
+  sched();
+  leave();
+}
+
+// First code a new thread runs. It was switched to from
+// inside sched(), so it owns that sched()'s enter().
+static void
+thread_start(void)
+{
+  leave();
+  current_thread->func();
+  thread_exit();
+}
+
+// Create a thread running func at the default priority.
+// Returns 0 if out of memory.
+struct thread *
 thread_create(void (*func)())
 {
   struct thread *t;
+  char *stack;
 
-  for (t = all_thread; t < all_thread + MAX_THREAD; t++) {
-    if (t->state == FREE) break;
+  enter();
+  if((t = freethreads) != 0)
+    freethreads = t->next;
+  else if((t = malloc(sizeof(*t))) == 0)
+    goto bad;
+  if((stack = freestacks) != 0)
+    freestacks = *(char **)stack;
+  else if((stack = malloc(STACK_SIZE)) == 0){
+    t->next = freethreads;
+    freethreads = t;
+    goto bad;
   }
-  t->state = RUNNABLE;
-  // YOUR CODE HERE
-  t->context.ra=(uint64)func;
-  t->context.sp=(uint64)&t->stack[STACK_SIZE-1];
-  t->context.fp=(uint64)&t->stack[STACK_SIZE-1];
+
+  memset(t, 0, sizeof(*t));
+  t->stack = stack;
+  t->prio = DEFPRIO;
+  t->id = nextid++;
+  t->func = func;
+  //让ra指向线程的入口，sp和fp指向栈底
+  t->context.ra = (uint64)thread_start;
+  t->context.sp = (uint64)(stack + STACK_SIZE);
+  t->context.fp = (uint64)(stack + STACK_SIZE);
+  ready_push(t);
+  leave();
+  return t;
+
+bad:
+  leave();
+  return 0;
+}
+
+// Change t's priority; takes effect the next time t becomes
+// runnable.
+void
+thread_setprio(struct thread *t, int prio)
+{
+  if(prio >= 0 && prio < NPRIO)
+    t->prio = prio;
 }
 
-void 
+void
 thread_yield(void)
 {
-  current_thread->state = RUNNABLE;
-  thread_schedule();
+  enter();
+  ready_push(current_thread);
+  sched();
+  leave();
+}
+
+void
+thread_exit(void)
+{
+  struct thread *t = current_thread;
+
+  enter();
+  t->state = ZOMBIE;
+  if(t->joiner)
+    ready_push(t->joiner);
+  sched();
+  // not reached: nothing schedules a ZOMBIE
+}
+
+// Wait for t to exit and recycle it. Returns -1 if t is the
+// caller or main, or another thread is already joining it.
+int
+thread_join(struct thread *t)
+{
+  enter();
+  if(t == current_thread || t->stack == 0 ||
+     (t->joiner && t->joiner != current_thread)){
+    leave();
+    return -1;
+  }
+  while(t->state != ZOMBIE){
+    t->joiner = current_thread;
+    current_thread->state = BLOCKED;
+    sched();
+  }
+  *(char **)t->stack = freestacks;
+  freestacks = t->stack;
+  t->state = FREE;
+  t->next = freethreads;
+  freethreads = t;
+  leave();
+  return 0;
+}
+
+void
+thread_mutex_init(struct thread_mutex *m)
+{
+  memset(m, 0, sizeof(*m));
+}
+
+void
+thread_mutex_lock(struct thread_mutex *m)
+{
+  enter();
+  if(!m->locked){
+    m->locked = 1;
+    m->owner = current_thread;
+  } else {
+    // thread_mutex_unlock() hands the mutex straight to us.
+    tq_push(&m->waiters, current_thread);
+    current_thread->state = BLOCKED;
+    sched();
+  }
+  leave();
+}
+
+// Release m, passing it to the longest waiter if any.
+static void
+mutex_release(struct thread_mutex *m)
+{
+  struct thread *w = tq_pop(&m->waiters);
+
+  if(w){
+    m->owner = w;
+    ready_push(w);
+  } else {
+    m->locked = 0;
+    m->owner = 0;
+  }
+}
+
+void
+thread_mutex_unlock(struct thread_mutex *m)
+{
+  enter();
+  mutex_release(m);
+  leave();
+}
+
+void
+thread_cond_init(struct thread_cond *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+// Atomically release m and park until signalled, then
+// reacquire m. Wakeups can race with other threads taking m
+// first, so callers should recheck their condition in a loop.
+void
+thread_cond_wait(struct thread_cond *c, struct thread_mutex *m)
+{
+  enter();
+  tq_push(&c->waiters, current_thread);
+  current_thread->state = BLOCKED;
+  mutex_release(m);
+  sched();
+  leave();
+  thread_mutex_lock(m);
+}
+
+void
+thread_cond_signal(struct thread_cond *c)
+{
+  struct thread *w;
+
+  enter();
+  if((w = tq_pop(&c->waiters)) != 0)
+    ready_push(w);
+  leave();
+}
+
+void
+thread_cond_broadcast(struct thread_cond *c)
+{
+  struct thread *w;
+
+  enter();
+  while((w = tq_pop(&c->waiters)) != 0)
+    ready_push(w);
+  leave();
+}
+
+// Alarm upcall: yield on behalf of the interrupted thread,
+// unless it is inside the library, in which case leave()
+// yields once it gets out.
+static void
+preempt(void *frame)
+{
+  if(nopreempt){
+    pending = 1;
+  } else {
+    sigalarm(quantum, preempt); // let the next thread be preempted too
+    thread_yield();
+  }
+  sigreturn(frame);
+}
+
+// Preempt the running thread every ticks clock ticks;
+// 0 turns preemption off.
+void
+thread_preempt(int ticks)
+{
+  quantum = ticks;
+  sigalarm(ticks, ticks ? preempt : 0);
 }
 
 volatile int a_started, b_started, c_started;
 volatile int a_n, b_n, c_n;
 
-void 
+void
 thread_a(void)
 {
   int i;
@@ -123,7 +442,7 @@ thread_a(void)
   a_started = 1;
   while(b_started == 0 || c_started == 0)
     thread_yield();
-  
+
   for (i = 0; i < 100; i++) {
     printf("thread_a %d\n", i);
     a_n += 1;
@@ -131,11 +450,10 @@ thread_a(void)
   }
   printf("thread_a: exit after %d\n", a_n);
 
-  current_thread->state = FREE;
-  thread_schedule();
+  thread_exit();
 }
 
-void 
+void
 thread_b(void)
 {
   int i;
@@ -143,7 +461,7 @@ thread_b(void)
   b_started = 1;
   while(a_started == 0 || c_started == 0)
     thread_yield();
-  
+
   for (i = 0; i < 100; i++) {
     printf("thread_b %d\n", i);
     b_n += 1;
@@ -151,11 +469,10 @@ thread_b(void)
   }
   printf("thread_b: exit after %d\n", b_n);
 
-  current_thread->state = FREE;
-  thread_schedule();
+  thread_exit();
 }
 
-void 
+void
 thread_c(void)
 {
   int i;
@@ -163,7 +480,7 @@ thread_c(void)
   c_started = 1;
   while(a_started == 0 || b_started == 0)
     thread_yield();
-  
+
   for (i = 0; i < 100; i++) {
     printf("thread_c %d\n", i);
     c_n += 1;
@@ -171,16 +488,179 @@ thread_c(void)
   }
   printf("thread_c: exit after %d\n", c_n);
 
-  current_thread->state = FREE;
-  thread_schedule();
+  thread_exit();
+}
+
+//
+// uthread -t: exercise join, mutexes, condvars and preemption.
+//
+
+#define NWORKER 4
+#define NITER   1000
+
+struct thread_mutex tm;
+struct thread_cond tc;
+volatile int counter, turn, spun;
+
+// Each worker takes turns with the others through the
+// condvar, and bumps counter under the mutex.
+void
+worker(void)
+{
+  int me = current_thread->id % NWORKER;
+
+  for(int i = 0; i < NITER; i++){
+    thread_mutex_lock(&tm);
+    while(turn != me)
+      thread_cond_wait(&tc, &tm);
+    counter++;
+    turn = (turn + 1) % NWORKER;
+    thread_cond_broadcast(&tc);
+    thread_mutex_unlock(&tm);
+  }
 }
 
-int 
-main(int argc, char *argv[]) 
+// Never yields: only finishes if preemption lets the other
+// spinner run.
+void
+spinner(void)
 {
+  int me = current_thread->id & 1;
+
+  while(spun != me)
+    ;
+  spun = !me;
+  while(spun != me)
+    ;
+  spun = !me;
+}
+
+void
+test(void)
+{
+  struct thread *t[NWORKER];
+  int i;
+
+  thread_mutex_init(&tm);
+  thread_cond_init(&tc);
+  // ids are handed out in order; make worker k have id%NWORKER == k
+  while(nextid % NWORKER != 0)
+    nextid++;
+  for(i = 0; i < NWORKER; i++)
+    if((t[i] = thread_create(worker)) == 0){
+      printf("uthread: thread_create failed\n");
+      exit(1);
+    }
+  for(i = 0; i < NWORKER; i++)
+    if(thread_join(t[i]) < 0){
+      printf("uthread: thread_join failed\n");
+      exit(1);
+    }
+  if(counter != NWORKER*NITER){
+    printf("uthread: counter %d, expected %d\n", counter, NWORKER*NITER);
+    exit(1);
+  }
+  printf("uthread: join/mutex/condvar ok\n");
+
+  thread_preempt(1);
+  spun = 0;
+  while(nextid % 2 != 0)
+    nextid++;
+  t[0] = thread_create(spinner);
+  t[1] = thread_create(spinner);
+  thread_join(t[0]);
+  thread_join(t[1]);
+  thread_preempt(0);
+  printf("uthread: preemption ok\n");
+}
+
+//
+// uthread -b [n]: context switches per tick, through
+// thread_yield() and through a condvar ping-pong.
+//
+
+int nbench;
+
+void
+yielder(void)
+{
+  for(int i = 0; i < nbench; i++)
+    thread_yield();
+}
+
+void
+ponger(void)
+{
+  int me = current_thread->id & 1;
+
+  thread_mutex_lock(&tm);
+  for(int i = 0; i < nbench; i++){
+    while(turn != me)
+      thread_cond_wait(&tc, &tm);
+    turn = !me;
+    thread_cond_signal(&tc);
+  }
+  thread_mutex_unlock(&tm);
+}
+
+void
+report(char *what, uint64 n, int t)
+{
+  printf("%s: %d switches, %d ticks", what, (int)n, t);
+  if(t > 0)
+    printf(", %d switches/tick", (int)(n / t));
+  printf("\n");
+}
+
+void
+bench(int n)
+{
+  struct thread *a, *b;
+  uint64 n0;
+  int t0;
+
+  nbench = n;
+  n0 = nswitch;
+  t0 = uptime();
+  a = thread_create(yielder);
+  b = thread_create(yielder);
+  thread_join(a);
+  thread_join(b);
+  report("yield", nswitch - n0, uptime() - t0);
+
+  thread_mutex_init(&tm);
+  thread_cond_init(&tc);
+  turn = 0;
+  while(nextid % 2 != 0)
+    nextid++;
+  n0 = nswitch;
+  t0 = uptime();
+  a = thread_create(ponger);
+  b = thread_create(ponger);
+  thread_join(a);
+  thread_join(b);
+  report("condvar", nswitch - n0, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_init();
+  if(argc > 1 && strcmp(argv[1], "-t") == 0){
+    test();
+    exit(0);
+  }
+  if(argc > 1 && strcmp(argv[1], "-b") == 0){
+    bench(argc > 2 ? atoi(argv[2]) : 100000);
+    exit(0);
+  }
+  if(argc > 1){
+    fprintf(2, "usage: uthread [-t | -b [n]]\n");
+    exit(1);
+  }
+
   a_started = b_started = c_started = 0;
   a_n = b_n = c_n = 0;
-  thread_init();
   thread_create(thread_a);
   thread_create(thread_b);
   thread_create(thread_c);
@@ -0,0 +1,62 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/vmstat.h"
+#include "user/user.h"
+
+//
+// vmstat command [args...]
+// Run command and print the virtual memory events and
+// clock ticks it caused.
+//
+
+int
+main(int argc, char *argv[])
+{
+  struct vmstat a, b;
+  int pid, t0, t1;
+
+  if(argc < 2){
+    fprintf(2, "usage: vmstat command [args...]\n");
+    exit(1);
+  }
+
+  if(vmstat(&a) < 0){
+    fprintf(2, "vmstat: vmstat failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "vmstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "vmstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  t1 = uptime();
+  vmstat(&b);
+
+  printf("ticks %d\n", t1 - t0);
+  printf("cow: shared %d copied %d reused %d\n", (int)(b.cowshare - a.cowshare),
+         (int)(b.cowcopy - a.cowcopy), (int)(b.cowreuse - a.cowreuse));
+  printf("lazy: filled %d\n", (int)(b.lazyfill - a.lazyfill));
+  printf("file: filled %d cached %d\n", (int)(b.filefill - a.filefill),
+         (int)(b.filecached - a.filecached));
+  printf("super: filled %d split %d\n", (int)(b.superfill - a.superfill),
+         (int)(b.demote - a.demote));
+  printf("faults %d, swap: out %d in %d\n", (int)(b.faults - a.faults),
+         (int)(b.swapout - a.swapout), (int)(b.swapin - a.swapin));
+
+  // Free memory afterwards, and how it is broken up: the free
+  // blocks of 1, 2, 4, ... pages, as kept by the kernel's buddy
+  // allocator.
+  printf("free: %d pages, blocks", (int)b.freepages);
+  for(int i = 0; i <= MAXORDER; i++)
+    printf(" %d", (int)b.freeblocks[i]);
+  printf("\n");
+  exit(0);
+}